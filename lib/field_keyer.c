@@ -0,0 +1,492 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexer.h"
+
+#define min(a, b) (a < b ? a : b)
+
+// Longest numeric literal we bother to parse out of text records.
+#define FIELD_NUM_MAX_LEN 32
+
+typedef struct Field_Span {
+	const u8 *ptr;
+	u64 len;
+} Field_Span;
+
+/* ------------ BEGIN Encoding ------------ */
+
+static void put_be(u8 *key, u64 key_size, u64 v) {
+	u64 width = min(key_size, 8);
+	memset(key, 0, key_size - width);
+	for (u64 i = 0; i < width; i++) {
+		key[key_size - 1 - i] = (u8)(v >> (i * 8));
+	}
+}
+
+// Values that do not fit in the key are clamped so that ordering still holds,
+// only their relative order with other clamped values is lost.
+static void encode_uint(u8 *key, u64 key_size, u64 v) {
+	u64 width = min(key_size, 8);
+	if (width < 8) {
+		u64 max = (1ULL << (width * 8)) - 1;
+		if (v > max) {
+			v = max;
+		}
+	}
+	put_be(key, key_size, v);
+}
+
+static void encode_int(u8 *key, u64 key_size, i64 v) {
+	u64 width = min(key_size, 8);
+	u64 bits = width * 8;
+	i64 lo = bits == 64 ? INT64_MIN : -(1LL << (bits - 1));
+	i64 hi = bits == 64 ? INT64_MAX : (1LL << (bits - 1)) - 1;
+	if (v < lo) {
+		v = lo;
+	} else if (v > hi) {
+		v = hi;
+	}
+	// Flipping the sign bit maps [lo, hi] monotonically onto [0, 2^bits).
+	u64 biased = ((u64)v ^ (1ULL << (bits - 1))) & (bits == 64 ? ~0ULL : (1ULL << bits) - 1);
+	put_be(key, key_size, biased);
+}
+
+static void encode_string(u8 *key, u64 key_size, Field_Span s) {
+	u64 n = min(s.len, key_size);
+	memcpy(key, s.ptr, n);
+	memset(key + n, 0, key_size - n);
+}
+
+static bool encode_text(const Field_Keyer *fk, Field_Span s, u8 *key) {
+	if (fk->encoding == FIELD_ENC_STRING) {
+		encode_string(key, fk->key_size, s);
+		return true;
+	}
+
+	char num[FIELD_NUM_MAX_LEN + 1];
+	while (s.len > 0 && isspace(*s.ptr)) {
+		s.ptr++;
+		s.len--;
+	}
+	while (s.len > 0 && isspace(s.ptr[s.len - 1])) {
+		s.len--;
+	}
+	if (s.len == 0 || s.len > FIELD_NUM_MAX_LEN) {
+		return false;
+	}
+	memcpy(num, s.ptr, s.len);
+	num[s.len] = '\0';
+
+	char *end;
+	errno = 0;
+	if (fk->encoding == FIELD_ENC_UINT) {
+		if (num[0] == '-') {
+			return false;
+		}
+		unsigned long long v = strtoull(num, &end, 10);
+		if (*end != '\0' || errno == ERANGE) {
+			return false;
+		}
+		encode_uint(key, fk->key_size, v);
+	} else {
+		long long v = strtoll(num, &end, 10);
+		if (*end != '\0' || errno == ERANGE) {
+			return false;
+		}
+		encode_int(key, fk->key_size, v);
+	}
+	return true;
+}
+
+/* ------------ END Encoding ------------ */
+
+/* ------------ BEGIN CSV ------------ */
+
+// Quoted fields are returned without their surrounding quotes; doubled quotes
+// inside them are left as-is, which keeps the span zero-copy.
+static bool csv_find_column(const u8 *rec, u64 len, u32 column, char delim, Field_Span *out) {
+	u64 i = 0;
+	u32 col = 0;
+	while (i <= len) {
+		u64 start = i;
+		u64 end;
+		if (i < len && rec[i] == '"') {
+			start = ++i;
+			while (i < len) {
+				if (rec[i] == '"') {
+					if (i + 1 < len && rec[i + 1] == '"') {
+						i += 2;
+						continue;
+					}
+					break;
+				}
+				i++;
+			}
+			end = i;
+			while (i < len && rec[i] != delim && rec[i] != '\n') {
+				i++;
+			}
+		} else {
+			while (i < len && rec[i] != delim && rec[i] != '\n' && rec[i] != '\r') {
+				i++;
+			}
+			end = i;
+			while (i < len && rec[i] != delim && rec[i] != '\n') {
+				i++;
+			}
+		}
+
+		if (col == column) {
+			out->ptr = rec + start;
+			out->len = end - start;
+			return true;
+		}
+		if (i >= len || rec[i] != delim) {
+			return false;
+		}
+		i++;
+		col++;
+	}
+	return false;
+}
+
+/* ------------ END CSV ------------ */
+
+/* ------------ BEGIN JSON ------------ */
+
+typedef struct Json_Cursor {
+	const u8 *p;
+	const u8 *end;
+} Json_Cursor;
+
+static void json_skip_ws(Json_Cursor *c) {
+	while (c->p < c->end && isspace(*c->p)) {
+		c->p++;
+	}
+}
+
+// Leaves the cursor after the closing quote, out gets the raw (still escaped) body.
+static bool json_scan_string(Json_Cursor *c, Field_Span *out) {
+	if (c->p >= c->end || *c->p != '"') {
+		return false;
+	}
+	const u8 *start = ++c->p;
+	while (c->p < c->end && *c->p != '"') {
+		if (*c->p == '\\') {
+			c->p++;
+		}
+		c->p++;
+	}
+	if (c->p >= c->end) {
+		return false;
+	}
+	out->ptr = start;
+	out->len = c->p - start;
+	c->p++;
+	return true;
+}
+
+static bool json_skip_value(Json_Cursor *c) {
+	Field_Span ignored;
+	json_skip_ws(c);
+	if (c->p >= c->end) {
+		return false;
+	}
+	if (*c->p == '"') {
+		return json_scan_string(c, &ignored);
+	}
+	if (*c->p == '{' || *c->p == '[') {
+		u64 depth = 0;
+		while (c->p < c->end) {
+			if (*c->p == '"') {
+				if (!json_scan_string(c, &ignored)) {
+					return false;
+				}
+				continue;
+			}
+			if (*c->p == '{' || *c->p == '[') {
+				depth++;
+			} else if (*c->p == '}' || *c->p == ']') {
+				if (--depth == 0) {
+					c->p++;
+					return true;
+				}
+			}
+			c->p++;
+		}
+		return false;
+	}
+	// number, true, false, null
+	while (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != ']' && !isspace(*c->p)) {
+		c->p++;
+	}
+	return true;
+}
+
+// Scalar values only: strings yield their raw body, numbers and literals their text.
+static bool json_scan_scalar(Json_Cursor *c, Field_Span *out, bool *quoted) {
+	json_skip_ws(c);
+	if (c->p >= c->end) {
+		return false;
+	}
+	*quoted = *c->p == '"';
+	if (*quoted) {
+		return json_scan_string(c, out);
+	}
+	if (*c->p == '{' || *c->p == '[') {
+		return false;
+	}
+	const u8 *start = c->p;
+	json_skip_value(c);
+	out->ptr = start;
+	out->len = c->p - start;
+	return out->len > 0;
+}
+
+static bool json_find_path(const u8 *rec, u64 len, const char *path, Field_Span *out, bool *quoted) {
+	Json_Cursor c = {rec, rec + len};
+	const char *seg = path;
+
+	for (;;) {
+		const char *dot = strchr(seg, '.');
+		u64 seg_len = dot ? (u64)(dot - seg) : strlen(seg);
+
+		json_skip_ws(&c);
+		if (c.p >= c.end || *c.p != '{') {
+			return false;
+		}
+		c.p++;
+
+		bool found = false;
+		for (;;) {
+			Field_Span name;
+			json_skip_ws(&c);
+			if (c.p < c.end && *c.p == '}') {
+				return false;
+			}
+			if (!json_scan_string(&c, &name)) {
+				return false;
+			}
+			json_skip_ws(&c);
+			if (c.p >= c.end || *c.p != ':') {
+				return false;
+			}
+			c.p++;
+
+			if (name.len == seg_len && memcmp(name.ptr, seg, seg_len) == 0) {
+				found = true;
+				break;
+			}
+			if (!json_skip_value(&c)) {
+				return false;
+			}
+			json_skip_ws(&c);
+			if (c.p < c.end && *c.p == ',') {
+				c.p++;
+			}
+		}
+
+		if (!found) {
+			return false;
+		}
+		if (!dot) {
+			return json_scan_scalar(&c, out, quoted);
+		}
+		seg = dot + 1;
+	}
+}
+
+static bool json_hex4(const u8 **p, const u8 *end, u32 *out) {
+	if (end - *p < 4) {
+		return false;
+	}
+	u32 v = 0;
+	for (int i = 0; i < 4; i++) {
+		u8 h = (*p)[i];
+		if (!isxdigit(h)) {
+			return false;
+		}
+		v = (v << 4) | (u32)(isdigit(h) ? h - '0' : (tolower(h) - 'a' + 10));
+	}
+	*p += 4;
+	*out = v;
+	return true;
+}
+
+static u64 utf8_encode(u32 cp, u8 *out) {
+	if (cp < 0x80) {
+		out[0] = (u8)cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		out[0] = (u8)(0xc0 | (cp >> 6));
+		out[1] = (u8)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if (cp < 0x10000) {
+		out[0] = (u8)(0xe0 | (cp >> 12));
+		out[1] = (u8)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (u8)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (u8)(0xf0 | (cp >> 18));
+	out[1] = (u8)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (u8)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (u8)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+// Decode the escapes of a raw string body straight into the key, so that
+// "\u0041" and "A" get the same key and escaped characters sort as themselves.
+// Only as much of the body as fits in the key is decoded.
+static bool json_encode_string(u8 *key, u64 key_size, Field_Span s) {
+	const u8 *p = s.ptr;
+	const u8 *end = s.ptr + s.len;
+	u64 n = 0;
+	while (p < end && n < key_size) {
+		u8 ch[4];
+		u64 ch_len = 1;
+		if (*p != '\\') {
+			ch[0] = *p++;
+		} else {
+			if (++p >= end) {
+				return false;
+			}
+			u8 esc = *p++;
+			u32 cp;
+			switch (esc) {
+			case '"':
+			case '\\':
+			case '/':
+				ch[0] = esc;
+				break;
+			case 'b':
+				ch[0] = '\b';
+				break;
+			case 'f':
+				ch[0] = '\f';
+				break;
+			case 'n':
+				ch[0] = '\n';
+				break;
+			case 'r':
+				ch[0] = '\r';
+				break;
+			case 't':
+				ch[0] = '\t';
+				break;
+			case 'u':
+				if (!json_hex4(&p, end, &cp) || (cp >= 0xdc00 && cp <= 0xdfff)) {
+					return false;
+				}
+				if (cp >= 0xd800 && cp <= 0xdbff) {
+					u32 lo;
+					if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+						return false;
+					}
+					p += 2;
+					if (!json_hex4(&p, end, &lo) || lo < 0xdc00 || lo > 0xdfff) {
+						return false;
+					}
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				}
+				ch_len = utf8_encode(cp, ch);
+				break;
+			default:
+				return false;
+			}
+		}
+		u64 take = min(ch_len, key_size - n);
+		memcpy(key + n, ch, take);
+		n += take;
+	}
+	memset(key + n, 0, key_size - n);
+	return true;
+}
+
+/* ------------ END JSON ------------ */
+
+/* ------------ BEGIN Binary ------------ */
+
+static bool binary_extract(const Field_Keyer *fk, const u8 *rec, u64 len, u8 *key) {
+	u64 off = fk->binary.offset;
+	u64 width = fk->binary.width;
+	if (width == 0 || off > len || width > len - off) {
+		return false;
+	}
+	const u8 *f = rec + off;
+
+	if (fk->encoding == FIELD_ENC_STRING) {
+		encode_string(key, fk->key_size, (Field_Span){f, width});
+		return true;
+	}
+	if (width > 8) {
+		return false;
+	}
+
+	u64 v = 0;
+	for (u64 i = 0; i < width; i++) {
+		u8 b = fk->binary.big_endian ? f[i] : f[width - 1 - i];
+		v = (v << 8) | b;
+	}
+
+	if (fk->encoding == FIELD_ENC_UINT) {
+		encode_uint(key, fk->key_size, v);
+	} else {
+		// sign-extend from the field width
+		u64 shift = 64 - width * 8;
+		encode_int(key, fk->key_size, (i64)(v << shift) >> shift);
+	}
+	return true;
+}
+
+/* ------------ END Binary ------------ */
+
+bool field_keyer_extract(const Field_Keyer *fk, Indexer_In_Buffer *buf, u64 offset, u64 length, u8 *key) {
+	if (fk == NULL || buf == NULL || key == NULL || fk->key_size == 0) {
+		return false;
+	}
+	if (offset > buf->size || length > buf->size - offset) {
+		return false;
+	}
+	const u8 *rec = (const u8 *)buf->src + offset;
+	Field_Span s;
+
+	switch (fk->source) {
+	case FIELD_SRC_CSV:
+		if (!csv_find_column(rec, length, fk->csv.column, fk->csv.delim ? fk->csv.delim : ',', &s)) {
+			return false;
+		}
+		return encode_text(fk, s, key);
+	case FIELD_SRC_JSON: {
+		bool quoted;
+		if (fk->json.path == NULL || !json_find_path(rec, length, fk->json.path, &s, &quoted)) {
+			return false;
+		}
+		if (quoted && fk->encoding == FIELD_ENC_STRING) {
+			return json_encode_string(key, fk->key_size, s);
+		}
+		return encode_text(fk, s, key);
+	}
+	case FIELD_SRC_BINARY:
+		return binary_extract(fk, rec, length, key);
+	}
+	return false;
+}
+
+u8 *field_key_fn(const Field_Keyer *fk, Indexer_In_Buffer *buf, u64 offset, u64 length) {
+	if (fk == NULL || fk->key_size == 0) {
+		return NULL;
+	}
+	u8 *key = malloc(fk->key_size);
+	if (!key) {
+		return NULL;
+	}
+	if (!field_keyer_extract(fk, buf, offset, length, key)) {
+		free(key);
+		return NULL;
+	}
+	return key;
+}
@@ -1,7 +1,21 @@
+#define _GNU_SOURCE
+
 #include "indexer.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "slice.h"
 
 #define packed __attribute__((packed))
 
@@ -35,8 +49,14 @@ typedef struct Indexer_Index_s {
 	Indexer_Entry_s *entries;
 } Indexer_Index_s;
 
+typedef struct Indexer_Kernels_s Indexer_Kernels_s;
+
+typedef struct Indexer_Live_s Indexer_Live_s;
+
 typedef struct Indexer_Ctx_s {
 	Indexer_Index *index;
+	const Indexer_Kernels_s *kernels;  // picked from the key width by indexer_bind_kernels
+	Indexer_Live_s *live;              // set by indexer_live_init
 } Indexer_Ctx_s;
 
 #define min(a, b) (a < b ? a : b)
@@ -116,19 +136,310 @@ bool with_checksum(u8 descriptor) {
 	return (descriptor & DESC_WITH_CHECKSUM) != 0;
 }
 
-void indexer_create_header(Indexer_Ctx_s *ctx, u64 key_size, u8 descriptor) {
-	Indexer_Header *header = malloc(sizeof(Indexer_Header));
-	if (!header) {
+static u64 index_key_size(const Indexer_Header_s *header) {
+	u64 size = header->entry_size - sizeof(Indexer_Entry_s);
+	if (with_checksum(header->descriptor)) {
+		size -= sizeof(u64);
+	}
+	return size;
+}
+
+static Indexer_Entry_s *index_entry_at(Indexer_Index_s *index, u64 i) {
+	return (Indexer_Entry_s *)((u8 *)index->entries + i * index->header.entry_size);
+}
+
+/* ------------ BEGIN Key kernels ------------ */
+
+// Sort and search over the packed entry array. Keys are compared as unsigned
+// big-endian numbers (i.e. memcmp order). The common key widths get kernels
+// where the key and entry sizes are compile-time constants, so compares are
+// native integer compares and entry copies are fixed-size moves; any other
+// width goes through the generic memcmp/memcpy kernel.
+
+#define KEY_OFFSET offsetof(Indexer_Entry_s, key)
+#define RADIX_DIGITS 256
+
+__extension__ typedef unsigned __int128 u128;
+
+typedef struct Indexer_Kernels_s {
+	const char *name;
+	bool (*sort)(u8 *base, u8 *scratch, u64 n, u64 entry_size, u64 key_size);  // false on allocation failure
+	u64 (*bound)(const u8 *base, u64 n, u64 entry_size, u64 key_size, const u8 *key, bool upper);
+} Indexer_Kernels_s;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define be32_to_native(x) __builtin_bswap32(x)
+#define be64_to_native(x) __builtin_bswap64(x)
+#else
+#define be32_to_native(x) (x)
+#define be64_to_native(x) (x)
+#endif
+
+static u32 load_key32(const u8 *p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return be32_to_native(v);
+}
+
+static u64 load_key64(const u8 *p) {
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return be64_to_native(v);
+}
+
+static u128 load_key128(const u8 *p) {
+	return ((u128)load_key64(p) << 64) | load_key64(p + 8);
+}
+
+// LSD radix sort, one byte per pass. All histograms are built in a single read
+// of the keys, and passes where every key has the same digit are skipped. The
+// digit of pass d is a fixed-offset byte of the entry, so no key decoding is
+// needed while scattering; the native loads are only used by the search.
+#define DEFINE_KEY_KERNEL(SUFFIX, KEY_T, LOAD, KEY_SIZE, ENTRY_SIZE)                         \
+	static bool sort_##SUFFIX(u8 *base, u8 *scratch, u64 n, u64 entry_size, u64 key_size) { \
+		(void)entry_size;                                                                    \
+		(void)key_size;                                                                      \
+		u64 counts[KEY_SIZE][RADIX_DIGITS];                                                  \
+		memset(counts, 0, sizeof(counts));                                                   \
+		for (u64 i = 0; i < n; i++) {                                                        \
+			const u8 *key = base + i * (ENTRY_SIZE) + KEY_OFFSET;                            \
+			for (u64 d = 0; d < (KEY_SIZE); d++) {                                           \
+				counts[d][key[(KEY_SIZE) - 1 - d]]++;                                        \
+			}                                                                                \
+		}                                                                                    \
+                                                                                             \
+		u8 *src = base;                                                                      \
+		u8 *dst = scratch;                                                                   \
+		for (u64 d = 0; d < (KEY_SIZE); d++) {                                               \
+			const u64 col = KEY_OFFSET + (KEY_SIZE) - 1 - d;                                 \
+			if (counts[d][src[col]] == n) {                                                  \
+				continue;                                                                    \
+			}                                                                                \
+			u64 pos[RADIX_DIGITS];                                                           \
+			u64 sum = 0;                                                                     \
+			for (u64 b = 0; b < RADIX_DIGITS; b++) {                                         \
+				pos[b] = sum;                                                                \
+				sum += counts[d][b];                                                         \
+			}                                                                                \
+			for (u64 i = 0; i < n; i++) {                                                    \
+				const u8 *e = src + i * (ENTRY_SIZE);                                        \
+				memcpy(dst + pos[e[col]]++ * (ENTRY_SIZE), e, (ENTRY_SIZE));                 \
+			}                                                                                \
+			u8 *tmp = src;                                                                   \
+			src = dst;                                                                       \
+			dst = tmp;                                                                       \
+		}                                                                                    \
+		if (src != base) {                                                                   \
+			memcpy(base, src, n * (ENTRY_SIZE));                                             \
+		}                                                                                    \
+		return true;                                                                         \
+	}                                                                                        \
+                                                                                             \
+	static u64 bound_##SUFFIX(const u8 *base, u64 n, u64 entry_size, u64 key_size,          \
+	                          const u8 *key, bool upper) {                                   \
+		(void)entry_size;                                                                    \
+		(void)key_size;                                                                      \
+		KEY_T k = LOAD(key);                                                                 \
+		u64 lo = 0;                                                                          \
+		u64 hi = n;                                                                          \
+		while (lo < hi) {                                                                    \
+			u64 mid = lo + (hi - lo) / 2;                                                    \
+			KEY_T m = LOAD(base + mid * (ENTRY_SIZE) + KEY_OFFSET);                          \
+			if (m < k || (upper && m == k)) {                                                \
+				lo = mid + 1;                                                                \
+			} else {                                                                         \
+				hi = mid;                                                                    \
+			}                                                                                \
+		}                                                                                    \
+		return lo;                                                                           \
+	}                                                                                        \
+                                                                                             \
+	static const Indexer_Kernels_s kernels_##SUFFIX = {#SUFFIX, sort_##SUFFIX, bound_##SUFFIX};
+
+#define DEFINE_KEY_KERNELS(BITS, KEY_T, LOAD)                                                  \
+	DEFINE_KEY_KERNEL(k##BITS, KEY_T, LOAD, BITS / 8, sizeof(Indexer_Entry_s) + BITS / 8)      \
+	DEFINE_KEY_KERNEL(k##BITS##_checksum, KEY_T, LOAD, BITS / 8,                               \
+	                  sizeof(Indexer_Entry_s) + BITS / 8 + sizeof(u64))
+
+DEFINE_KEY_KERNELS(32, u32, load_key32)    // xxhash32
+DEFINE_KEY_KERNELS(64, u64, load_key64)    // xxhash64, XXH3
+DEFINE_KEY_KERNELS(128, u128, load_key128) // xxhash128
+
+static bool sort_generic(u8 *base, u8 *scratch, u64 n, u64 entry_size, u64 key_size) {
+	u64 *counts = calloc(key_size * RADIX_DIGITS, sizeof(u64));
+	if (!counts) {
+		return false;
+	}
+	for (u64 i = 0; i < n; i++) {
+		const u8 *key = base + i * entry_size + KEY_OFFSET;
+		for (u64 d = 0; d < key_size; d++) {
+			counts[d * RADIX_DIGITS + key[key_size - 1 - d]]++;
+		}
+	}
+
+	u8 *src = base;
+	u8 *dst = scratch;
+	for (u64 d = 0; d < key_size; d++) {
+		u64 *count = counts + d * RADIX_DIGITS;
+		u64 col = KEY_OFFSET + key_size - 1 - d;
+		if (count[src[col]] == n) {
+			continue;
+		}
+		u64 pos[RADIX_DIGITS];
+		u64 sum = 0;
+		for (u64 b = 0; b < RADIX_DIGITS; b++) {
+			pos[b] = sum;
+			sum += count[b];
+		}
+		for (u64 i = 0; i < n; i++) {
+			const u8 *e = src + i * entry_size;
+			memcpy(dst + pos[e[col]]++ * entry_size, e, entry_size);
+		}
+		u8 *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != base) {
+		memcpy(base, src, n * entry_size);
+	}
+	free(counts);
+	return true;
+}
+
+static u64 bound_generic(const u8 *base, u64 n, u64 entry_size, u64 key_size, const u8 *key, bool upper) {
+	u64 lo = 0;
+	u64 hi = n;
+	while (lo < hi) {
+		u64 mid = lo + (hi - lo) / 2;
+		int cmp = memcmp(base + mid * entry_size + KEY_OFFSET, key, key_size);
+		if (cmp < 0 || (upper && cmp == 0)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static const Indexer_Kernels_s kernels_generic = {"generic", sort_generic, bound_generic};
+
+static const Indexer_Kernels_s *select_kernels(const Indexer_Header_s *header) {
+	bool checksum = with_checksum(header->descriptor);
+	switch (index_key_size(header)) {
+	case 4:
+		return checksum ? &kernels_k32_checksum : &kernels_k32;
+	case 8:
+		return checksum ? &kernels_k64_checksum : &kernels_k64;
+	case 16:
+		return checksum ? &kernels_k128_checksum : &kernels_k128;
+	default:
+		return &kernels_generic;
+	}
+}
+
+void indexer_bind_kernels(Indexer_Ctx_s *ctx) {
+	if (!ctx || !ctx->index) {
 		return;
 	}
-	header->magic_number = INDEX_HEADER_MAGIC_NUMBER;
-	header->descriptor = descriptor;
-	header->entry_size = sizeof(Indexer_Entry) + key_size;
+	ctx->kernels = select_kernels(&ctx->index->header);
+}
+
+void indexer_bind_generic_kernels(Indexer_Ctx_s *ctx) {
+	if (!ctx) {
+		return;
+	}
+	ctx->kernels = &kernels_generic;
+}
+
+const char *indexer_kernels_name(const Indexer_Ctx_s *ctx) {
+	return ctx && ctx->kernels ? ctx->kernels->name : NULL;
+}
+
+bool indexer_sort_entries(Indexer_Ctx_s *ctx) {
+	if (!ctx || !ctx->index || ctx->live) {
+		return false;
+	}
+	Indexer_Index_s *index = ctx->index;
+	if (index->header.entry_nums < 2) {
+		return true;
+	}
+	if (!ctx->kernels) {
+		indexer_bind_kernels(ctx);
+	}
+	u8 *scratch = malloc(index->header.entry_nums * index->header.entry_size);
+	if (!scratch) {
+		return false;
+	}
+	bool ok = ctx->kernels->sort((u8 *)index->entries, scratch, index->header.entry_nums,
+	                             index->header.entry_size, index_key_size(&index->header));
+	free(scratch);
+	return ok;
+}
+
+/* ------------ END Key kernels ------------ */
+
+void indexer_create_header(Indexer_Ctx_s *ctx, u64 key_size, u8 descriptor) {
+	Indexer_Header_s header = {
+	    .magic_number = INDEX_HEADER_MAGIC_NUMBER,
+	    .entry_size = sizeof(Indexer_Entry) + key_size,
+	    .entry_nums = 0,
+	    .descriptor = descriptor,
+	};
 	if (with_checksum(descriptor)) {
-		header->entry_size += sizeof(u64);
+		header.entry_size += sizeof(u64);
+	}
+	ctx->index->header = header;
+	indexer_bind_kernels(ctx);
+}
+
+Indexer_Ctx_s *indexer_ctx_new(u64 key_size, u8 descriptor) {
+	Indexer_Ctx_s *ctx = calloc(1, sizeof(Indexer_Ctx_s));
+	Indexer_Index_s *index = calloc(1, sizeof(Indexer_Index_s));
+	if (!ctx || !index) {
+		free(ctx);
+		free(index);
+		return NULL;
 	}
-	header->entry_nums = 0;
-	ctx->index->header = *header;
+	ctx->index = index;
+	indexer_create_header(ctx, key_size, descriptor);
+	return ctx;
+}
+
+void indexer_ctx_free(Indexer_Ctx_s *ctx) {
+	if (!ctx) {
+		return;
+	}
+	indexer_live_destroy(ctx);
+	free(ctx->index);
+	free(ctx);
+}
+
+void indexer_ctx_set_entries(Indexer_Ctx_s *ctx, void *entries, u64 entry_nums) {
+	ctx->index->entries = entries;
+	ctx->index->header.entry_nums = entry_nums;
+}
+
+u64 indexer_entry_size(const Indexer_Ctx_s *ctx) {
+	return ctx->index->header.entry_size;
+}
+
+u64 indexer_key_size(const Indexer_Ctx_s *ctx) {
+	return index_key_size(&ctx->index->header);
+}
+
+void indexer_entry_set(Indexer_Entry *entry, u64 offset, u64 length, const u8 *key, u64 key_size) {
+	entry->offset = offset;
+	entry->length = length;
+	entry->checksum = 0;
+	memcpy(entry->key, key, key_size);
+}
+
+u64 indexer_entry_offset(const Indexer_Entry *entry) {
+	return entry->offset;
+}
+
+const u8 *indexer_entry_key(const Indexer_Entry *entry) {
+	return entry->key;
 }
 
 void indexer_create_entry(Indexer_Ctx_s *ctx, Indexer_In_Buffer *in_buf, u8 descriptor, Keyer_Fn keyer_fn) {
@@ -137,4 +448,1236 @@ void indexer_create_entry(Indexer_Ctx_s *ctx, Indexer_In_Buffer *in_buf, u8 desc
 		return;
 	}
 	u8 *key = keyer_fn(in_buf, 0, in_buf->size);
-}
\ No newline at end of file
+}
+
+/* ------------ BEGIN Range scan ------------ */
+
+u64 indexer_range_scan(Indexer_Ctx_s *ctx, const u8 *lo, const u8 *hi, Indexer_Entry **first) {
+	if (first) {
+		*first = NULL;
+	}
+	if (!ctx || !ctx->index || ctx->live || !ctx->index->entries || !lo || !hi) {
+		return 0;
+	}
+	Indexer_Index_s *index = ctx->index;
+	u64 key_size = index_key_size(&index->header);
+	if (memcmp(lo, hi, key_size) > 0) {
+		return 0;
+	}
+	if (!ctx->kernels) {
+		indexer_bind_kernels(ctx);
+	}
+
+	const u8 *base = (const u8 *)index->entries;
+	u64 n = index->header.entry_nums;
+	u64 es = index->header.entry_size;
+	u64 begin = ctx->kernels->bound(base, n, es, key_size, lo, false);
+	u64 end = ctx->kernels->bound(base, n, es, key_size, hi, true);
+	if (first) {
+		*first = begin < end ? index_entry_at(index, begin) : NULL;
+	}
+	return end - begin;
+}
+
+/* ------------ END Range scan ------------ */
+
+/* ------------ BEGIN Writer ------------ */
+
+// Entries are staged in a ring of slices and written out with one pwritev per
+// full ring. After every flush, writeback of that window is started with
+// sync_file_range and the previous window is waited on, so the page cache
+// never holds more than two windows of dirty index data. Slices are allocated
+// on first use and no larger than the expected payload, so small files (a
+// shard of a few entries, a manifest) cost one small buffer. The index header
+// goes out with the first window as a placeholder and is patched with the
+// final entry_nums on commit. Everything is written to a temp file next to the
+// target, which is renamed over it once it is durable.
+
+#define WRITER_BUFFERS 8
+#define WRITER_BUFFER_SIZE (4 << 20)
+#define WRITER_TMP_ATTEMPTS 100
+
+typedef struct Writer_Buffer_s {
+	Slice *slice;
+	u8 *base;  // slices never grow, so their backing buffer is stable
+} Writer_Buffer_s;
+
+typedef struct Indexer_Writer_s {
+	int fd;
+	char *path;
+	char *tmp_path;
+	Indexer_Header_s header;
+	bool has_header;  // index files patch their header on commit, manifests have none
+	bool sync_dir;    // fsync the parent directory after the rename
+	u64 buffer_size;
+	u64 file_off;    // bytes handed to the kernel so far
+	u64 synced_off;  // start of the window whose writeback is in flight
+	u32 cur;         // buffer being filled
+	Writer_Buffer_s bufs[WRITER_BUFFERS];
+} Indexer_Writer_s;
+
+static atomic_uint writer_tmp_seq;
+
+static bool write_all_at(int fd, struct iovec *iov, int iovcnt, u64 off) {
+	while (iovcnt > 0) {
+		ssize_t n = pwritev(fd, iov, iovcnt, off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return false;
+		}
+		off += n;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (u8 *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+static bool fsync_dir(const char *dir) {
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	// Some filesystems cannot sync directories, nothing more to do there.
+	bool ok = fsync(fd) == 0 || errno == EINVAL;
+	close(fd);
+	return ok;
+}
+
+static bool fsync_parent_dir(const char *path) {
+	const char *slash = strrchr(path, '/');
+	if (!slash) {
+		return fsync_dir(".");
+	}
+	if (slash == path) {
+		return fsync_dir("/");
+	}
+	char *dir = strndup(path, slash - path);
+	bool ok = dir && fsync_dir(dir);
+	free(dir);
+	return ok;
+}
+
+// Write every staged buffer, plus extra if given, in a single vectored write.
+static bool writer_flush(Indexer_Writer_s *w, const void *extra, u64 extra_len) {
+	struct iovec iov[WRITER_BUFFERS + 1];
+	int iovcnt = 0;
+	u64 len = 0;
+	for (u32 i = 0; i <= w->cur && i < WRITER_BUFFERS; i++) {
+		size_t n = w->bufs[i].slice ? slice_get_len(w->bufs[i].slice) : 0;
+		if (n > 0) {
+			iov[iovcnt++] = (struct iovec){w->bufs[i].base, n};
+			len += n;
+		}
+	}
+	if (extra_len > 0) {
+		iov[iovcnt++] = (struct iovec){(void *)extra, extra_len};
+		len += extra_len;
+	}
+	if (len == 0) {
+		return true;
+	}
+	if (!write_all_at(w->fd, iov, iovcnt, w->file_off)) {
+		return false;
+	}
+
+	// Wait for the previous window, then kick off writeback of this one.
+	if (w->file_off > w->synced_off) {
+		sync_file_range(w->fd, w->synced_off, w->file_off - w->synced_off,
+		                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+	sync_file_range(w->fd, w->file_off, len, SYNC_FILE_RANGE_WRITE);
+	w->synced_off = w->file_off;
+	w->file_off += len;
+
+	for (u32 i = 0; i < WRITER_BUFFERS; i++) {
+		if (w->bufs[i].slice) {
+			slice_set_len(w->bufs[i].slice, 0);
+		}
+	}
+	w->cur = 0;
+	return true;
+}
+
+static bool writer_stage(Indexer_Writer_s *w, const void *data, u64 len) {
+	const u8 *src = data;
+	while (len > 0) {
+		Writer_Buffer_s *buf = &w->bufs[w->cur];
+		if (!buf->slice) {
+			buf->slice = slice_char_new(w->buffer_size, 0);
+			if (!buf->slice) {
+				return false;
+			}
+			buf->base = slice_get_ptr_offset(buf->slice);
+		}
+		u64 room = slice_get_usable_cap(buf->slice);
+		if (room == 0) {
+			if (w->cur + 1 < WRITER_BUFFERS) {
+				w->cur++;
+			} else if (!writer_flush(w, NULL, 0)) {
+				return false;
+			}
+			continue;
+		}
+		u64 n = min(room, len);
+		memcpy(slice_get_ptr_offset(buf->slice), src, n);
+		slice_incr_len(buf->slice, n);
+		src += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void writer_free(Indexer_Writer_s *w) {
+	for (u32 i = 0; i < WRITER_BUFFERS; i++) {
+		slice_free(w->bufs[i].slice);
+	}
+	free(w->tmp_path);
+	free(w->path);
+	free(w);
+}
+
+// The temp file is created with 0666 so the umask applies as it would to the
+// target; an existing target keeps its mode.
+static int writer_create_tmp(Indexer_Writer_s *w, size_t tmp_len) {
+	int fd = -1;
+	for (int attempt = 0; attempt < WRITER_TMP_ATTEMPTS; attempt++) {
+		snprintf(w->tmp_path, tmp_len, "%s.tmp.%d.%u", w->path, (int)getpid(), atomic_fetch_add(&writer_tmp_seq, 1));
+		fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd >= 0 || errno != EEXIST) {
+			break;
+		}
+	}
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	if (stat(w->path, &st) == 0 && fchmod(fd, st.st_mode & 07777) != 0) {
+		close(fd);
+		unlink(w->tmp_path);
+		return -1;
+	}
+	return fd;
+}
+
+// size_hint is the expected file size, 0 if unknown.
+static Indexer_Writer_s *writer_new(const char *path, u64 size_hint, bool sync_dir) {
+	Indexer_Writer_s *w = calloc(1, sizeof(Indexer_Writer_s));
+	if (!w) {
+		return NULL;
+	}
+	w->fd = -1;
+	w->sync_dir = sync_dir;
+	w->buffer_size = size_hint > 0 && size_hint < WRITER_BUFFER_SIZE ? size_hint : WRITER_BUFFER_SIZE;
+	w->path = strdup(path);
+	size_t tmp_len = strlen(path) + sizeof(".tmp.") + 2 * 11;
+	w->tmp_path = malloc(tmp_len);
+	if (!w->path || !w->tmp_path) {
+		writer_free(w);
+		return NULL;
+	}
+	w->fd = writer_create_tmp(w, tmp_len);
+	if (w->fd < 0) {
+		writer_free(w);
+		return NULL;
+	}
+	return w;
+}
+
+static void writer_abort(Indexer_Writer_s *w) {
+	if (w->fd >= 0) {
+		close(w->fd);
+		unlink(w->tmp_path);
+	}
+	writer_free(w);
+}
+
+static bool writer_commit(Indexer_Writer_s *w) {
+	bool ok = writer_flush(w, NULL, 0);
+	if (ok && w->has_header) {
+		ok = pwrite(w->fd, &w->header, sizeof(w->header), 0) == (ssize_t)sizeof(w->header);
+	}
+	ok = ok && fdatasync(w->fd) == 0;
+	ok = close(w->fd) == 0 && ok;
+	w->fd = -1;
+	ok = ok && rename(w->tmp_path, w->path) == 0;
+	if (!ok) {
+		unlink(w->tmp_path);
+		writer_free(w);
+		return false;
+	}
+	// Make the rename itself durable.
+	ok = !w->sync_dir || fsync_parent_dir(w->path);
+	writer_free(w);
+	return ok;
+}
+
+static Indexer_Writer_s *writer_open_index(const Indexer_Header_s *header, const char *path, u64 size_hint, bool sync_dir) {
+	Indexer_Writer_s *w = writer_new(path, size_hint, sync_dir);
+	if (!w) {
+		return NULL;
+	}
+	w->header = *header;
+	w->header.entry_nums = 0;
+	w->has_header = true;
+	if (!writer_stage(w, &w->header, sizeof(w->header))) {
+		writer_abort(w);
+		return NULL;
+	}
+	return w;
+}
+
+static bool write_index(const Indexer_Header_s *header, const void *entries, const char *path, bool sync_dir) {
+	u64 payload = header->entry_nums * header->entry_size;
+	Indexer_Writer_s *w = writer_open_index(header, path, sizeof(*header) + payload, sync_dir);
+	if (!w) {
+		return false;
+	}
+	if (!indexer_writer_append(w, entries, header->entry_nums)) {
+		writer_abort(w);
+		return false;
+	}
+	return writer_commit(w);
+}
+
+Indexer_Writer *indexer_writer_open(Indexer_Ctx_s *ctx, const char *path) {
+	if (!ctx || !ctx->index || ctx->live || !path) {
+		return NULL;
+	}
+	return writer_open_index(&ctx->index->header, path, 0, true);
+}
+
+bool indexer_writer_append(Indexer_Writer *w, const void *entries, u64 n) {
+	if (!w || (n > 0 && !entries)) {
+		return false;
+	}
+	u64 len = n * w->header.entry_size;
+	bool ok;
+	// Large batches go straight from the caller's memory, behind whatever is staged.
+	if (len >= WRITER_BUFFER_SIZE) {
+		ok = writer_flush(w, entries, len);
+	} else {
+		ok = writer_stage(w, entries, len);
+	}
+	if (ok) {
+		w->header.entry_nums += n;
+	}
+	return ok;
+}
+
+bool indexer_writer_commit(Indexer_Writer *w) {
+	if (!w) {
+		return false;
+	}
+	return writer_commit(w);
+}
+
+void indexer_writer_abort(Indexer_Writer *w) {
+	if (!w) {
+		return;
+	}
+	writer_abort(w);
+}
+
+bool indexer_write_index(Indexer_Ctx_s *ctx, const char *path) {
+	if (!ctx || !ctx->index || ctx->live || !path || (ctx->index->header.entry_nums > 0 && !ctx->index->entries)) {
+		return false;
+	}
+	return write_index(&ctx->index->header, ctx->index->entries, path, true);
+}
+
+/* ------------ END Writer ------------ */
+
+/* ------------ BEGIN Sharding ------------ */
+
+// A sharded index is a manifest plus 2^shard_bits ordinary index files. Entry
+// i goes to the shard named by the top shard_bits bits of its key, so every
+// shard covers a disjoint key range and shards concatenated in order are
+// globally sorted.
+//
+// Every build writes its shards under a new generation number, never over the
+// files of the manifest currently in place. Renaming the new manifest over the
+// old one is the only commit point: until then the old manifest and its shards
+// are untouched, afterwards the old generation's shards are unlinked.
+//
+// Manifest layout:
+//   Indexer_Manifest_Header_s
+//   per shard: u64 entry_nums, min key, max key, u16 path_len, path bytes
+
+#define SHARD_MAX_BITS 16
+#define SHARD_MAX_KEY_SIZE 4096
+// Worker count when the number of online CPUs cannot be read.
+#define SHARD_FALLBACK_WORKERS 4
+
+typedef struct packed Indexer_Manifest_Header_s {
+	u32 magic_number;
+	u32 shard_bits;
+	u64 key_size;
+	u64 entry_size;
+	u64 entry_nums;
+	u8 descriptor;
+	u64 generation;
+} Indexer_Manifest_Header_s;
+
+typedef struct Manifest_Shard_s {
+	u64 entry_nums;
+	const u8 *min_key;
+	const u8 *max_key;
+	const char *path;  // relative to the manifest directory unless absolute
+	u16 path_len;
+} Manifest_Shard_s;
+
+typedef struct Indexer_Shard_s {
+	u8 *map;
+	size_t map_len;
+	u64 entry_nums;
+	const u8 *entries;
+} Indexer_Shard_s;
+
+typedef struct Indexer_Shards_s {
+	u32 shard_bits;
+	u32 shard_count;
+	u64 key_size;
+	u64 entry_size;
+	u8 descriptor;
+	const Indexer_Kernels_s *kernels;
+	Indexer_Shard_s shards[];
+} Indexer_Shards_s;
+
+typedef struct Shard_Job_s {
+	const Indexer_Kernels_s *kernels;
+	Indexer_Header_s header;  // entry_nums is filled per shard
+	u64 key_size;
+	u8 *entries;  // partitioned by shard
+	const u64 *starts;
+	char **paths;  // as stored in the manifest
+	char **files;  // paths resolved against the manifest directory
+	u8 *min_keys;
+	u8 *max_keys;
+	u32 shard_count;
+	atomic_uint next;
+	atomic_bool failed;
+} Shard_Job_s;
+
+static u32 key_prefix(const u8 *key, u64 key_size, u32 bits) {
+	u32 v = 0;
+	for (u64 i = 0; i < sizeof(v); i++) {
+		v = (v << 8) | (i < key_size ? key[i] : 0);
+	}
+	return bits == 0 ? 0 : v >> (32 - bits);
+}
+
+// Shard paths are stored in the manifest relative to the manifest's own
+// directory (absolute dirs stay absolute), so the index can be moved or opened
+// from any working directory.
+static char *shard_path(const char *manifest_path, const char *const *dirs, u32 ndirs, u64 gen, u32 i) {
+	const char *slash = strrchr(manifest_path, '/');
+	const char *name = slash ? slash + 1 : manifest_path;
+	const char *dir = ndirs > 0 ? dirs[i % ndirs] : NULL;
+	size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 40;
+	char *path = malloc(len);
+	if (!path) {
+		return NULL;
+	}
+	if (dir) {
+		snprintf(path, len, "%s/%s.%llu.%u", dir, name, (unsigned long long)gen, i);
+	} else {
+		snprintf(path, len, "%s.%llu.%u", name, (unsigned long long)gen, i);
+	}
+	return path;
+}
+
+// Turn a path stored in the manifest into one usable from the current directory.
+static char *manifest_resolve(const char *manifest_path, const char *path, size_t path_len) {
+	const char *slash = strrchr(manifest_path, '/');
+	size_t dir_len = (path_len > 0 && path[0] == '/') || !slash ? 0 : (size_t)(slash - manifest_path) + 1;
+	char *resolved = malloc(dir_len + path_len + 1);
+	if (!resolved) {
+		return NULL;
+	}
+	memcpy(resolved, manifest_path, dir_len);
+	memcpy(resolved + dir_len, path, path_len);
+	resolved[dir_len + path_len] = '\0';
+	return resolved;
+}
+
+static bool read_file(const char *path, u8 **data, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+	bool ok = false;
+	long size;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		goto out;
+	}
+	*data = malloc(size + 1);
+	if (!*data) {
+		goto out;
+	}
+	if (fread(*data, 1, size, f) != (size_t)size) {
+		free(*data);
+		*data = NULL;
+		goto out;
+	}
+	*len = size;
+	ok = true;
+out:
+	fclose(f);
+	return ok;
+}
+
+static bool manifest_read_header(const u8 *data, size_t len, Indexer_Manifest_Header_s *mh) {
+	if (len < sizeof(*mh)) {
+		return false;
+	}
+	memcpy(mh, data, sizeof(*mh));
+	if (mh->magic_number != INDEX_MANIFEST_MAGIC_NUMBER || mh->shard_bits > SHARD_MAX_BITS || mh->key_size == 0 ||
+	    mh->key_size > SHARD_MAX_KEY_SIZE || mh->shard_bits > mh->key_size * 8) {
+		return false;
+	}
+	// The kernels are picked from entry_size while routing and the caller's
+	// key use key_size, they have to describe the same layout.
+	return mh->entry_size == sizeof(Indexer_Entry_s) + mh->key_size + (with_checksum(mh->descriptor) ? sizeof(u64) : 0);
+}
+
+// Parse the shard record at *off, false if it runs past the end of the manifest.
+static bool manifest_next_shard(const u8 *data, size_t len, size_t *off, u64 key_size, Manifest_Shard_s *out) {
+	size_t fixed = sizeof(u64) + 2 * key_size + sizeof(u16);
+	if (len - *off < fixed) {
+		return false;
+	}
+	const u8 *p = data + *off;
+	memcpy(&out->entry_nums, p, sizeof(u64));
+	out->min_key = p + sizeof(u64);
+	out->max_key = out->min_key + key_size;
+	memcpy(&out->path_len, out->max_key + key_size, sizeof(u16));
+	*off += fixed;
+	if (len - *off < out->path_len) {
+		return false;
+	}
+	out->path = (const char *)data + *off;
+	*off += out->path_len;
+	return true;
+}
+
+// Best effort: the manifest replacing this one is already committed, leftover
+// shards only waste space.
+static void unlink_manifest_shards(const char *manifest_path, const u8 *data, size_t len) {
+	Indexer_Manifest_Header_s mh;
+	if (!manifest_read_header(data, len, &mh)) {
+		return;
+	}
+	size_t off = sizeof(mh);
+	Manifest_Shard_s ms;
+	for (u32 i = 0; i < (1u << mh.shard_bits) && manifest_next_shard(data, len, &off, mh.key_size, &ms); i++) {
+		char *path = manifest_resolve(manifest_path, ms.path, ms.path_len);
+		if (path) {
+			unlink(path);
+		}
+		free(path);
+	}
+}
+
+static void *shard_worker(void *arg) {
+	Shard_Job_s *job = arg;
+	u64 es = job->header.entry_size;
+	u64 ks = job->key_size;
+
+	for (;;) {
+		u32 i = atomic_fetch_add(&job->next, 1);
+		if (i >= job->shard_count) {
+			break;
+		}
+		u64 n = job->starts[i + 1] - job->starts[i];
+		u8 *base = job->entries + job->starts[i] * es;
+
+		if (n > 1) {
+			u8 *scratch = malloc(n * es);
+			if (!scratch) {
+				atomic_store(&job->failed, true);
+				continue;
+			}
+			bool sorted = job->kernels->sort(base, scratch, n, es, ks);
+			free(scratch);
+			if (!sorted) {
+				atomic_store(&job->failed, true);
+				continue;
+			}
+		}
+		if (n > 0) {
+			memcpy(job->min_keys + i * ks, base + KEY_OFFSET, ks);
+			memcpy(job->max_keys + i * ks, base + (n - 1) * es + KEY_OFFSET, ks);
+		}
+
+		Indexer_Header_s header = job->header;
+		header.entry_nums = n;
+		// Directories are synced once for all shards, before the manifest.
+		if (!write_index(&header, base, job->files[i], false)) {
+			atomic_store(&job->failed, true);
+		}
+	}
+	return NULL;
+}
+
+// Written through the same temp file + rename path as the shards, so a reader
+// sees either the previous manifest or the new one, never a partial one.
+static bool write_manifest(const char *path, Shard_Job_s *job, u32 shard_bits, u64 gen) {
+	Indexer_Manifest_Header_s mh = {
+	    .magic_number = INDEX_MANIFEST_MAGIC_NUMBER,
+	    .shard_bits = shard_bits,
+	    .key_size = job->key_size,
+	    .entry_size = job->header.entry_size,
+	    .entry_nums = job->starts[job->shard_count],
+	    .descriptor = job->header.descriptor,
+	    .generation = gen,
+	};
+	u64 size = sizeof(mh);
+	for (u32 i = 0; i < job->shard_count; i++) {
+		size += sizeof(u64) + 2 * job->key_size + sizeof(u16) + strlen(job->paths[i]);
+	}
+
+	Indexer_Writer_s *w = writer_new(path, size, true);
+	if (!w) {
+		return false;
+	}
+	bool ok = writer_stage(w, &mh, sizeof(mh));
+	for (u32 i = 0; ok && i < job->shard_count; i++) {
+		u64 n = job->starts[i + 1] - job->starts[i];
+		u16 path_len = (u16)strlen(job->paths[i]);
+		ok = writer_stage(w, &n, sizeof(n)) &&
+		     writer_stage(w, job->min_keys + i * job->key_size, job->key_size) &&
+		     writer_stage(w, job->max_keys + i * job->key_size, job->key_size) &&
+		     writer_stage(w, &path_len, sizeof(path_len)) &&
+		     writer_stage(w, job->paths[i], path_len);
+	}
+	if (!ok) {
+		writer_abort(w);
+		return false;
+	}
+	return writer_commit(w);
+}
+
+bool indexer_write_sharded(Indexer_Ctx_s *ctx, const char *manifest_path, u32 shard_bits,
+                           const char *const *dirs, u32 ndirs) {
+	if (!ctx || !ctx->index || ctx->live || !manifest_path || shard_bits > SHARD_MAX_BITS) {
+		return false;
+	}
+	Indexer_Index_s *index = ctx->index;
+	u64 n = index->header.entry_nums;
+	u64 es = index->header.entry_size;
+	u64 ks = index_key_size(&index->header);
+	u32 shard_count = 1u << shard_bits;
+	if (shard_bits > ks * 8 || (n > 0 && !index->entries)) {
+		return false;
+	}
+	if (!ctx->kernels) {
+		indexer_bind_kernels(ctx);
+	}
+
+	// The manifest in place, if any, keeps naming its own shards until the new
+	// manifest replaces it.
+	u8 *prev = NULL;
+	size_t prev_len = 0;
+	u64 gen = 0;
+	Indexer_Manifest_Header_s prev_mh;
+	if (!read_file(manifest_path, &prev, &prev_len)) {
+		prev = NULL;
+	} else if (manifest_read_header(prev, prev_len, &prev_mh)) {
+		gen = prev_mh.generation + 1;
+	}
+
+	bool ok = false;
+	bool written = false;
+	u64 *starts = calloc(shard_count + 1, sizeof(u64));
+	u8 *parts = malloc(n * es + 1);
+	u8 *keys = calloc(2 * shard_count, ks);
+	char **paths = calloc(shard_count, sizeof(char *));
+	char **files = calloc(shard_count, sizeof(char *));
+	if (!starts || !parts || !keys || !paths || !files) {
+		goto out;
+	}
+	for (u32 i = 0; i < shard_count; i++) {
+		paths[i] = shard_path(manifest_path, dirs, ndirs, gen, i);
+		if (!paths[i] || strlen(paths[i]) > UINT16_MAX) {
+			goto out;
+		}
+		files[i] = manifest_resolve(manifest_path, paths[i], strlen(paths[i]));
+		if (!files[i]) {
+			goto out;
+		}
+	}
+
+	// Partition once, every shard is then sorted independently.
+	const u8 *src = (const u8 *)index->entries;
+	for (u64 i = 0; i < n; i++) {
+		starts[key_prefix(src + i * es + KEY_OFFSET, ks, shard_bits) + 1]++;
+	}
+	for (u32 i = 0; i < shard_count; i++) {
+		starts[i + 1] += starts[i];
+	}
+	u64 *pos = malloc(shard_count * sizeof(u64));
+	if (!pos) {
+		goto out;
+	}
+	memcpy(pos, starts, shard_count * sizeof(u64));
+	for (u64 i = 0; i < n; i++) {
+		const u8 *e = src + i * es;
+		memcpy(parts + pos[key_prefix(e + KEY_OFFSET, ks, shard_bits)]++ * es, e, es);
+	}
+	free(pos);
+
+	Shard_Job_s job = {
+	    .kernels = ctx->kernels,
+	    .header = index->header,
+	    .key_size = ks,
+	    .entries = parts,
+	    .starts = starts,
+	    .paths = paths,
+	    .files = files,
+	    .min_keys = keys,
+	    .max_keys = keys + shard_count * ks,
+	    .shard_count = shard_count,
+	};
+	atomic_init(&job.next, 0);
+	atomic_init(&job.failed, false);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	u64 nworkers = cpus > 0 ? (u64)cpus : SHARD_FALLBACK_WORKERS;
+	nworkers = min(nworkers, shard_count);
+	pthread_t *workers = malloc(nworkers * sizeof(pthread_t));
+	if (!workers) {
+		goto out;
+	}
+	written = true;
+	u32 started = 0;
+	while (started < nworkers && pthread_create(&workers[started], NULL, shard_worker, &job) == 0) {
+		started++;
+	}
+	if (started == 0) {
+		shard_worker(&job);
+	}
+	for (u32 i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	if (atomic_load(&job.failed)) {
+		goto out;
+	}
+	// Shard i lives in dirs[i % ndirs], so the first ndirs shards cover every
+	// directory. Their entries must be durable before the manifest points at them.
+	for (u32 i = 0; i < shard_count && i < (ndirs > 0 ? ndirs : 1); i++) {
+		if (!fsync_parent_dir(files[i])) {
+			goto out;
+		}
+	}
+	// A failed manifest commit may still have renamed the manifest into place,
+	// so from here on this generation's shards are kept.
+	written = false;
+	ok = write_manifest(manifest_path, &job, shard_bits, gen);
+	if (ok && prev) {
+		unlink_manifest_shards(manifest_path, prev, prev_len);
+	}
+
+out:
+	for (u32 i = 0; i < shard_count; i++) {
+		if (paths) {
+			free(paths[i]);
+		}
+		if (files) {
+			// Nothing refers to this generation's shards yet.
+			if (!ok && written && files[i]) {
+				unlink(files[i]);
+			}
+			free(files[i]);
+		}
+	}
+	free(prev);
+	free(paths);
+	free(files);
+	free(keys);
+	free(parts);
+	free(starts);
+	return ok;
+}
+
+static bool map_shard(Indexer_Shard_s *shard, u32 i, const char *path, const Manifest_Shard_s *ms, const Indexer_Shards_s *shards) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Indexer_Header_s);
+	if (ok) {
+		shard->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		ok = shard->map != MAP_FAILED;
+	}
+	close(fd);
+	if (!ok) {
+		shard->map = NULL;
+		return false;
+	}
+	shard->map_len = st.st_size;
+
+	Indexer_Header_s header;
+	memcpy(&header, shard->map, sizeof(header));
+	if (header.magic_number != INDEX_HEADER_MAGIC_NUMBER || header.entry_size != shards->entry_size ||
+	    header.descriptor != shards->descriptor || header.entry_nums != shard->entry_nums ||
+	    header.entry_nums > (shard->map_len - sizeof(header)) / header.entry_size) {
+		return false;
+	}
+	shard->entries = shard->map + sizeof(header);
+
+	// The manifest's key range must be the shard's, and inside the shard's prefix.
+	if (shard->entry_nums > 0) {
+		u64 ks = shards->key_size;
+		const u8 *first = shard->entries + KEY_OFFSET;
+		const u8 *last = shard->entries + (shard->entry_nums - 1) * header.entry_size + KEY_OFFSET;
+		if (memcmp(first, ms->min_key, ks) != 0 || memcmp(last, ms->max_key, ks) != 0 ||
+		    key_prefix(ms->min_key, ks, shards->shard_bits) != i || key_prefix(ms->max_key, ks, shards->shard_bits) != i) {
+			return false;
+		}
+	}
+	madvise(shard->map, shard->map_len, MADV_RANDOM);
+	return true;
+}
+
+Indexer_Shards *indexer_shards_open(const char *manifest_path) {
+	u8 *data;
+	size_t len;
+	if (!manifest_path || !read_file(manifest_path, &data, &len)) {
+		return NULL;
+	}
+
+	Indexer_Shards_s *shards = NULL;
+	Indexer_Manifest_Header_s mh;
+	if (!manifest_read_header(data, len, &mh)) {
+		goto fail;
+	}
+
+	u32 shard_count = 1u << mh.shard_bits;
+	shards = calloc(1, sizeof(Indexer_Shards_s) + shard_count * sizeof(Indexer_Shard_s));
+	if (!shards) {
+		goto fail;
+	}
+	shards->shard_bits = mh.shard_bits;
+	shards->shard_count = shard_count;
+	shards->key_size = mh.key_size;
+	shards->entry_size = mh.entry_size;
+	shards->descriptor = mh.descriptor;
+	Indexer_Header_s header = {.entry_size = mh.entry_size, .descriptor = mh.descriptor};
+	shards->kernels = select_kernels(&header);
+
+	size_t off = sizeof(mh);
+	u64 total = 0;
+	for (u32 i = 0; i < shard_count; i++) {
+		Indexer_Shard_s *shard = &shards->shards[i];
+		Manifest_Shard_s ms;
+		if (!manifest_next_shard(data, len, &off, mh.key_size, &ms)) {
+			goto fail;
+		}
+		shard->entry_nums = ms.entry_nums;
+		char *path = manifest_resolve(manifest_path, ms.path, ms.path_len);
+		bool mapped = path && map_shard(shard, i, path, &ms, shards);
+		free(path);
+		if (!mapped) {
+			goto fail;
+		}
+		total += shard->entry_nums;
+	}
+	if (off != len || total != mh.entry_nums) {
+		goto fail;
+	}
+	free(data);
+	return shards;
+
+fail:
+	free(data);
+	indexer_shards_close(shards);
+	return NULL;
+}
+
+u64 indexer_shards_lookup(Indexer_Shards *shards, const u8 *key, Indexer_Entry **first) {
+	if (first) {
+		*first = NULL;
+	}
+	if (!shards || !key) {
+		return 0;
+	}
+	const Indexer_Shard_s *shard = &shards->shards[key_prefix(key, shards->key_size, shards->shard_bits)];
+	u64 n = shard->entry_nums;
+	u64 es = shards->entry_size;
+	u64 ks = shards->key_size;
+	u64 begin = shards->kernels->bound(shard->entries, n, es, ks, key, false);
+	u64 end = shards->kernels->bound(shard->entries, n, es, ks, key, true);
+	if (first) {
+		*first = begin < end ? (Indexer_Entry *)(shard->entries + begin * es) : NULL;
+	}
+	return end - begin;
+}
+
+void indexer_shards_close(Indexer_Shards *shards) {
+	if (!shards) {
+		return;
+	}
+	for (u32 i = 0; i < shards->shard_count; i++) {
+		if (shards->shards[i].map) {
+			munmap(shards->shards[i].map, shards->shards[i].map_len);
+		}
+	}
+	free(shards);
+}
+
+/* ------------ END Sharding ------------ */
+
+/* ------------ BEGIN Snapshots ------------ */
+
+// Epoch based reclamation over immutable snapshots.
+//
+// A snapshot is a header plus a list of sorted, immutable segments. Appends
+// build a new snapshot (reusing the old segments, adding one sorted segment for
+// the new entries and merging similarly sized neighbours) and publish it with
+// an atomic pointer swap. The previous snapshot is retired, tagged with the
+// global epoch at the time of the swap.
+//
+// A reader pins by announcing the current global epoch in its slot and then
+// loading the snapshot pointer. A retired snapshot is only freed once every
+// pinned slot announces a later epoch than its tag, so a reader that could
+// have seen it is guaranteed to be gone. Readers never block and never write
+// shared state other than their own slot. Writers are serialized by a mutex.
+
+#define EPOCH_IDLE UINT64_MAX
+
+typedef struct Indexer_Segment_s {
+	u64 entry_nums;
+	u64 refs;  // snapshots referencing this segment, only touched by writers
+	u8 *entries;
+} Indexer_Segment_s;
+
+typedef struct Indexer_Snapshot_s {
+	Indexer_Header_s header;  // entry_nums is the total over all segments
+	const Indexer_Kernels_s *kernels;
+	u64 retire_epoch;
+	struct Indexer_Snapshot_s *retired_next;
+	u32 segment_count;
+	Indexer_Segment_s *segments[];
+} Indexer_Snapshot_s;
+
+typedef struct Indexer_Reader_s {
+	_Alignas(64) atomic_ullong epoch;  // EPOCH_IDLE when not pinned
+	atomic_bool used;
+	Indexer_Live_s *live;
+} Indexer_Reader_s;
+
+typedef struct Indexer_Live_s {
+	Indexer_Reader_s readers[INDEXER_MAX_READERS];
+	_Alignas(64) _Atomic(Indexer_Snapshot_s *) current;
+	atomic_ullong epoch;
+	pthread_mutex_t write_lock;
+	Indexer_Snapshot_s *retired;  // guarded by write_lock
+} Indexer_Live_s;
+
+static Indexer_Snapshot_s *snapshot_new(const Indexer_Snapshot_s *base, u32 segment_count) {
+	Indexer_Snapshot_s *snap = calloc(1, sizeof(Indexer_Snapshot_s) + segment_count * sizeof(Indexer_Segment_s *));
+	if (!snap) {
+		return NULL;
+	}
+	snap->header = base->header;
+	snap->kernels = base->kernels;
+	snap->segment_count = segment_count;
+	return snap;
+}
+
+static void segment_release(Indexer_Segment_s *seg) {
+	if (seg && --seg->refs == 0) {
+		free(seg->entries);
+		free(seg);
+	}
+}
+
+static void snapshot_free(Indexer_Snapshot_s *snap) {
+	for (u32 i = 0; i < snap->segment_count; i++) {
+		segment_release(snap->segments[i]);
+	}
+	free(snap);
+}
+
+static Indexer_Segment_s *segment_merge(const Indexer_Segment_s *a, const Indexer_Segment_s *b, u64 es, u64 ks) {
+	Indexer_Segment_s *seg = calloc(1, sizeof(Indexer_Segment_s));
+	if (!seg) {
+		return NULL;
+	}
+	seg->entry_nums = a->entry_nums + b->entry_nums;
+	seg->entries = malloc(seg->entry_nums * es);
+	if (!seg->entries) {
+		free(seg);
+		return NULL;
+	}
+
+	// a holds the older entries, it wins ties so equal keys keep append order
+	u64 i = 0;
+	u64 j = 0;
+	u8 *out = seg->entries;
+	while (i < a->entry_nums && j < b->entry_nums) {
+		const u8 *ea = a->entries + i * es;
+		const u8 *eb = b->entries + j * es;
+		if (memcmp(eb + KEY_OFFSET, ea + KEY_OFFSET, ks) < 0) {
+			memcpy(out, eb, es);
+			j++;
+		} else {
+			memcpy(out, ea, es);
+			i++;
+		}
+		out += es;
+	}
+	memcpy(out, a->entries + i * es, (a->entry_nums - i) * es);
+	out += (a->entry_nums - i) * es;
+	memcpy(out, b->entries + j * es, (b->entry_nums - j) * es);
+	return seg;
+}
+
+// Free retired snapshots that no pinned reader can still observe.
+static void live_reclaim(Indexer_Live_s *live) {
+	u64 oldest = EPOCH_IDLE;
+	for (u32 i = 0; i < INDEXER_MAX_READERS; i++) {
+		u64 e = atomic_load(&live->readers[i].epoch);
+		if (e < oldest) {
+			oldest = e;
+		}
+	}
+
+	Indexer_Snapshot_s **link = &live->retired;
+	while (*link) {
+		Indexer_Snapshot_s *snap = *link;
+		if (snap->retire_epoch < oldest) {
+			*link = snap->retired_next;
+			snapshot_free(snap);
+		} else {
+			link = &snap->retired_next;
+		}
+	}
+}
+
+static void live_publish(Indexer_Live_s *live, Indexer_Snapshot_s *snap) {
+	Indexer_Snapshot_s *old = atomic_exchange(&live->current, snap);
+	old->retire_epoch = atomic_fetch_add(&live->epoch, 1);
+	old->retired_next = live->retired;
+	live->retired = old;
+	live_reclaim(live);
+}
+
+bool indexer_live_init(Indexer_Ctx_s *ctx) {
+	if (!ctx || !ctx->index || ctx->live || (ctx->index->header.entry_nums > 0 && !ctx->index->entries)) {
+		return false;
+	}
+	if (!ctx->kernels) {
+		indexer_bind_kernels(ctx);
+	}
+	Indexer_Index_s *index = ctx->index;
+	u64 n = index->header.entry_nums;
+	u64 es = index->header.entry_size;
+
+	Indexer_Live_s *live = aligned_alloc(_Alignof(Indexer_Live_s), sizeof(Indexer_Live_s));
+	Indexer_Snapshot_s base = {.header = index->header, .kernels = ctx->kernels};
+	Indexer_Snapshot_s *snap = snapshot_new(&base, n > 0 ? 1 : 0);
+	Indexer_Segment_s *seg = n > 0 ? calloc(1, sizeof(Indexer_Segment_s)) : NULL;
+	u8 *scratch = n > 1 ? malloc(n * es) : NULL;
+	if (!live || !snap || (n > 0 && !seg) || (n > 1 && !scratch)) {
+		goto fail;
+	}
+	if (seg) {
+		seg->entries = malloc(n * es);
+		if (!seg->entries) {
+			goto fail;
+		}
+		memcpy(seg->entries, index->entries, n * es);
+		if (scratch && !ctx->kernels->sort(seg->entries, scratch, n, es, index_key_size(&index->header))) {
+			goto fail;
+		}
+		seg->entry_nums = n;
+		seg->refs = 1;
+		snap->segments[0] = seg;
+	}
+	free(scratch);
+
+	memset(live, 0, sizeof(*live));
+	for (u32 i = 0; i < INDEXER_MAX_READERS; i++) {
+		atomic_init(&live->readers[i].epoch, EPOCH_IDLE);
+		atomic_init(&live->readers[i].used, false);
+		live->readers[i].live = live;
+	}
+	atomic_init(&live->current, snap);
+	atomic_init(&live->epoch, 1);
+	pthread_mutex_init(&live->write_lock, NULL);
+	ctx->live = live;
+	return true;
+
+fail:
+	if (seg) {
+		free(seg->entries);
+	}
+	free(seg);
+	free(scratch);
+	free(snap);
+	free(live);
+	return false;
+}
+
+// All readers must have unregistered.
+void indexer_live_destroy(Indexer_Ctx_s *ctx) {
+	if (!ctx || !ctx->live) {
+		return;
+	}
+	Indexer_Live_s *live = ctx->live;
+	while (live->retired) {
+		Indexer_Snapshot_s *next = live->retired->retired_next;
+		snapshot_free(live->retired);
+		live->retired = next;
+	}
+	snapshot_free(atomic_load(&live->current));
+	pthread_mutex_destroy(&live->write_lock);
+	free(live);
+	ctx->live = NULL;
+}
+
+bool indexer_append_entries(Indexer_Ctx_s *ctx, const void *entries, u64 n) {
+	if (!ctx || !ctx->live || (n > 0 && !entries)) {
+		return false;
+	}
+	if (n == 0) {
+		return true;
+	}
+	Indexer_Live_s *live = ctx->live;
+	pthread_mutex_lock(&live->write_lock);
+
+	Indexer_Snapshot_s *cur = atomic_load(&live->current);
+	u64 es = cur->header.entry_size;
+	u64 ks = index_key_size(&cur->header);
+	bool ok = false;
+	Indexer_Snapshot_s *snap = NULL;
+	Indexer_Segment_s *seg = calloc(1, sizeof(Indexer_Segment_s));
+	u8 *scratch = malloc(n * es);
+	if (seg) {
+		seg->refs = 1;
+	}
+	if (!seg || !scratch || !(seg->entries = malloc(n * es))) {
+		goto out;
+	}
+	memcpy(seg->entries, entries, n * es);
+	if (!cur->kernels->sort(seg->entries, scratch, n, es, ks)) {
+		goto out;
+	}
+	seg->entry_nums = n;
+
+	// Size-tiered: fold the new segment into its predecessor while the
+	// predecessor is no more than twice as large, which keeps O(log n)
+	// segments per snapshot.
+	u32 count = cur->segment_count;
+	while (count > 0 && cur->segments[count - 1]->entry_nums <= 2 * seg->entry_nums) {
+		Indexer_Segment_s *merged = segment_merge(cur->segments[count - 1], seg, es, ks);
+		if (!merged) {
+			goto out;
+		}
+		merged->refs = 1;
+		segment_release(seg);
+		seg = merged;
+		count--;
+	}
+
+	snap = snapshot_new(cur, count + 1);
+	if (!snap) {
+		goto out;
+	}
+	for (u32 i = 0; i < count; i++) {
+		snap->segments[i] = cur->segments[i];
+		snap->segments[i]->refs++;
+	}
+	snap->segments[count] = seg;
+	snap->header.entry_nums = cur->header.entry_nums + n;
+	seg = NULL;
+
+	live_publish(live, snap);
+	ok = true;
+
+out:
+	segment_release(seg);
+	free(scratch);
+	pthread_mutex_unlock(&live->write_lock);
+	return ok;
+}
+
+Indexer_Reader *indexer_reader_register(Indexer_Ctx_s *ctx) {
+	if (!ctx || !ctx->live) {
+		return NULL;
+	}
+	for (u32 i = 0; i < INDEXER_MAX_READERS; i++) {
+		Indexer_Reader_s *reader = &ctx->live->readers[i];
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&reader->used, &expected, true)) {
+			return reader;
+		}
+	}
+	return NULL;
+}
+
+void indexer_reader_unregister(Indexer_Reader *reader) {
+	if (!reader) {
+		return;
+	}
+	atomic_store(&reader->epoch, EPOCH_IDLE);
+	atomic_store(&reader->used, false);
+}
+
+const Indexer_Snapshot *indexer_snapshot_pin(Indexer_Reader *reader) {
+	// seq_cst: the slot store must be visible before the pointer load, or a
+	// writer could retire and free what we are about to read.
+	atomic_store(&reader->epoch, atomic_load(&reader->live->epoch));
+	return atomic_load(&reader->live->current);
+}
+
+void indexer_snapshot_unpin(Indexer_Reader *reader) {
+	atomic_store_explicit(&reader->epoch, EPOCH_IDLE, memory_order_release);
+}
+
+u64 indexer_snapshot_entry_nums(const Indexer_Snapshot *snap) {
+	return snap ? snap->header.entry_nums : 0;
+}
+
+u64 indexer_snapshot_range_scan(const Indexer_Snapshot *snap, const u8 *lo, const u8 *hi, Indexer_Run_Fn fn, void *arg) {
+	if (!snap || !lo || !hi) {
+		return 0;
+	}
+	u64 es = snap->header.entry_size;
+	u64 ks = index_key_size(&snap->header);
+	if (memcmp(lo, hi, ks) > 0) {
+		return 0;
+	}
+
+	u64 total = 0;
+	for (u32 i = 0; i < snap->segment_count; i++) {
+		const Indexer_Segment_s *seg = snap->segments[i];
+		u64 begin = snap->kernels->bound(seg->entries, seg->entry_nums, es, ks, lo, false);
+		u64 end = snap->kernels->bound(seg->entries, seg->entry_nums, es, ks, hi, true);
+		if (begin < end && fn) {
+			fn((const Indexer_Entry *)(seg->entries + begin * es), end - begin, es, arg);
+		}
+		total += end - begin;
+	}
+	return total;
+}
+
+/* ------------ END Snapshots ------------ */
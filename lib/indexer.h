@@ -5,7 +5,10 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "util.h"
+
 #define INDEX_HEADER_MAGIC_NUMBER 0xB8C97B49
+#define INDEX_MANIFEST_MAGIC_NUMBER 0xB8C97B4A
 
 typedef struct Indexer_Index_s Indexer_Index;
 typedef struct Indexer_Header_s Indexer_Header;
@@ -35,6 +38,19 @@ typedef uint8_t *(*Keyer_Fn)(Indexer_In_Buffer *buf, u64 offset, u64 length);
 
 void indexer_create_header(Indexer_Ctx_s *ctx, u64 key_size, u8 descriptor);
 
+// Context over an in-memory index. The entries buffer handed to
+// indexer_ctx_set_entries stays owned by the caller.
+Indexer_Ctx_s *indexer_ctx_new(u64 key_size, u8 descriptor);
+void indexer_ctx_free(Indexer_Ctx_s *ctx);
+void indexer_ctx_set_entries(Indexer_Ctx_s *ctx, void *entries, u64 entry_nums);
+u64 indexer_entry_size(const Indexer_Ctx_s *ctx);
+u64 indexer_key_size(const Indexer_Ctx_s *ctx);
+
+// Entries are packed, entry i lives at entries + i * indexer_entry_size(ctx).
+void indexer_entry_set(Indexer_Entry *entry, u64 offset, u64 length, const u8 *key, u64 key_size);
+u64 indexer_entry_offset(const Indexer_Entry *entry);
+const u8 *indexer_entry_key(const Indexer_Entry *entry);
+
 // Create index entry from the entire data in in_buf buffer.
 void indexer_create_entry(Indexer_Ctx_s *ctx, Indexer_In_Buffer *in_buf, u8 descriptor, Keyer_Fn keyer_fn);
 
@@ -45,4 +61,172 @@ u8 *xxhash32_key_fn(Indexer_In_Buffer *buf, u64 offset, u64 length);
 u8 *xxhash64_key_fn(Indexer_In_Buffer *buf, u64 offset, u64 length);
 u8 *xxhash128_key_fn(Indexer_In_Buffer *buf, u64 offset, u64 length);
 
+// Field keyers
+//
+// Unlike the hash keyers, a field keyer pulls one field out of the record and
+// encodes it so that memcmp order on the key equals the natural order of the
+// field. This is what makes indexer_range_scan meaningful. JSON strings are
+// unescaped (\uXXXX as UTF-8) before encoding; quoted CSV fields keep their
+// doubled quotes and compare as those raw bytes.
+
+typedef enum Field_Source {
+	FIELD_SRC_CSV,    /**< n-th column of a delimited line */
+	FIELD_SRC_JSON,   /**< dotted path into a JSON object, e.g. "req.ts" */
+	FIELD_SRC_BINARY  /**< fixed offset/width field in a binary record */
+} Field_Source;
+
+typedef enum Field_Encoding {
+	FIELD_ENC_UINT,   /**< unsigned integer, big-endian */
+	FIELD_ENC_INT,    /**< signed integer, big-endian with the sign bit flipped */
+	FIELD_ENC_STRING  /**< raw bytes, truncated or zero padded to key_size */
+} Field_Encoding;
+
+typedef struct Field_Keyer_s {
+	Field_Source source;
+	Field_Encoding encoding;
+	u64 key_size;  // width of the produced key, integers use at most 8 bytes of it
+	union {
+		struct {
+			u32 column;  // 0-based
+			char delim;
+		} csv;
+		struct {
+			const char *path;
+		} json;
+		struct {
+			u64 offset;
+			u64 width;        // 1..8 for integer encodings
+			bool big_endian;  // byte order of the field in the record
+		} binary;
+	};
+} Field_Keyer;
+
+// Extract the field described by fk from the record at buf[offset, offset+length)
+// and write its fk->key_size bytes order-preserving encoding into key.
+// Returns false if the field is missing or cannot be parsed.
+bool field_keyer_extract(const Field_Keyer *fk, Indexer_In_Buffer *buf, u64 offset, u64 length, u8 *key);
+
+// Same as field_keyer_extract but allocates the key, the caller frees it.
+//
+// This is not a Keyer_Fn: a Keyer_Fn carries no per-keyer state, while a field
+// keyer needs its Field_Keyer. Build field keys with field_keyer_extract and
+// store them with indexer_entry_set instead of going through
+// indexer_create_entry.
+u8 *field_key_fn(const Field_Keyer *fk, Indexer_In_Buffer *buf, u64 offset, u64 length);
+
+// Sorting
+
+// Pick the sort/search kernels for the index key width. Called by
+// indexer_create_header; call it again after loading a header from elsewhere.
+void indexer_bind_kernels(Indexer_Ctx_s *ctx);
+
+// Force the memcmp/memcpy kernels whatever the key width, for tests and
+// benchmarks against the specialized ones.
+void indexer_bind_generic_kernels(Indexer_Ctx_s *ctx);
+
+// "k32", "k64_checksum", ..., or "generic".
+const char *indexer_kernels_name(const Indexer_Ctx_s *ctx);
+
+// Sort the entries by key (memcmp order). Returns false on allocation failure.
+bool indexer_sort_entries(Indexer_Ctx_s *ctx);
+
+// Range queries
+
+// Find every entry whose key k satisfies lo <= k <= hi (memcmp order) in the
+// sorted index. Matching entries are contiguous; *first is set to the first of
+// them, or to NULL when nothing matches or the arguments are invalid, and
+// their number is returned. lo and hi must be key_size bytes long.
+u64 indexer_range_scan(Indexer_Ctx_s *ctx, const u8 *lo, const u8 *hi, Indexer_Entry **first);
+
+// Sharded indexes
+
+typedef struct Indexer_Shards_s Indexer_Shards;
+
+// Partition the entries by the top shard_bits bits of their key into
+// 2^shard_bits index files, sort and write each shard on a worker thread, then
+// write the manifest at manifest_path. Shard i is written to
+// "<dirs[i % ndirs]>/<manifest name>.<gen>.<i>", or next to the manifest when
+// ndirs is 0, where gen is one past the generation of the manifest being
+// replaced (0 for a new index). Relative dirs are taken relative to the
+// manifest's directory. The entries in ctx are left untouched.
+//
+// Rebuilding over an existing manifest is atomic: the old manifest and its
+// shards stay valid until the new manifest is renamed over it, after which the
+// old generation's shards are unlinked.
+bool indexer_write_sharded(Indexer_Ctx_s *ctx, const char *manifest_path, u32 shard_bits,
+                           const char *const *dirs, u32 ndirs);
+
+// Open a manifest and map all of its shards read-only.
+Indexer_Shards *indexer_shards_open(const char *manifest_path);
+
+// Exact key lookup routed by key prefix to a single shard. Same contract as
+// indexer_range_scan with lo == hi.
+u64 indexer_shards_lookup(Indexer_Shards *shards, const u8 *key, Indexer_Entry **first);
+
+void indexer_shards_close(Indexer_Shards *shards);
+
+// Snapshot isolated readers
+//
+// indexer_live_init copies the current entries of ctx into the first snapshot.
+// From then on indexer_append_entries publishes a new snapshot per call while
+// readers keep using whatever snapshot they pinned, without taking locks.
+// A reader slot is used by one thread at a time and pins one snapshot at a time.
+//
+// Appends only reach the snapshots, so while live mode is on the entry points
+// that read the entries of ctx directly (indexer_sort_entries,
+// indexer_range_scan, indexer_write_index, indexer_writer_open and
+// indexer_write_sharded) fail instead of returning stale data. Query through
+// a pinned snapshot instead. After indexer_live_destroy they work again on the
+// entries ctx had before indexer_live_init, without the appends.
+
+#define INDEXER_MAX_READERS 64
+
+typedef struct Indexer_Snapshot_s Indexer_Snapshot;
+typedef struct Indexer_Reader_s Indexer_Reader;
+
+// Called once per contiguous run of matching entries, runs are sorted within
+// but not across calls.
+typedef void (*Indexer_Run_Fn)(const Indexer_Entry *first, u64 count, u64 entry_size, void *arg);
+
+bool indexer_live_init(Indexer_Ctx_s *ctx);
+void indexer_live_destroy(Indexer_Ctx_s *ctx);
+
+// Append n entries of header.entry_size bytes each. Writers are serialized.
+bool indexer_append_entries(Indexer_Ctx_s *ctx, const void *entries, u64 n);
+
+// Returns NULL when all INDEXER_MAX_READERS slots are taken.
+Indexer_Reader *indexer_reader_register(Indexer_Ctx_s *ctx);
+void indexer_reader_unregister(Indexer_Reader *reader);
+
+// The snapshot stays valid until the matching unpin.
+const Indexer_Snapshot *indexer_snapshot_pin(Indexer_Reader *reader);
+void indexer_snapshot_unpin(Indexer_Reader *reader);
+
+u64 indexer_snapshot_entry_nums(const Indexer_Snapshot *snap);
+u64 indexer_snapshot_range_scan(const Indexer_Snapshot *snap, const u8 *lo, const u8 *hi, Indexer_Run_Fn fn, void *arg);
+
+// Index output
+//
+// The file is the packed header followed by the entries. It is built in a temp
+// file next to path and atomically renamed over path on commit, so readers
+// either see the previous index or the complete new one.
+
+typedef struct Indexer_Writer_s Indexer_Writer;
+
+// Start an index file with the header layout of ctx (entry_nums is counted by
+// the writer).
+Indexer_Writer *indexer_writer_open(Indexer_Ctx_s *ctx, const char *path);
+
+// Append n entries of header.entry_size bytes each.
+bool indexer_writer_append(Indexer_Writer *w, const void *entries, u64 n);
+
+// Flush, patch the header, fsync and rename into place. Frees w either way.
+bool indexer_writer_commit(Indexer_Writer *w);
+
+// Drop the temp file. Frees w.
+void indexer_writer_abort(Indexer_Writer *w);
+
+// Write the in-memory entries of ctx as they are to path.
+bool indexer_write_index(Indexer_Ctx_s *ctx, const char *path);
+
 #endif  // INDEXER_H
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+static Indexer_In_Buffer in_buf(const void *src, size_t size) {
+	Indexer_In_Buffer buf = {src, size, 0};
+	return buf;
+}
+
+static bool extract_str(const Field_Keyer *fk, const char *rec, u8 *key) {
+	Indexer_In_Buffer buf = in_buf(rec, strlen(rec));
+	return field_keyer_extract(fk, &buf, 0, buf.size, key);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// Test 1: CSV unsigned column is big-endian
+void test_field_keyer_csv_uint(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_CSV, .encoding = FIELD_ENC_UINT, .key_size = 8, .csv = {1, ','}};
+	u8 key[8];
+	u8 expected[8] = {0, 0, 0, 0, 0x65, 0x43, 0x21, 0x00};
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "GET,1698898176,/index.html\n", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, key, 8);
+}
+
+// Test 2: CSV quoted string column is padded
+void test_field_keyer_csv_quoted_string(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_CSV, .encoding = FIELD_ENC_STRING, .key_size = 8, .csv = {2, ';'}};
+	u8 key[8];
+	u8 expected[8] = {'a', ';', 'b', 0, 0, 0, 0, 0};
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "x;y;\"a;b\";z", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, key, 8);
+}
+
+// Test 3: Missing CSV column
+void test_field_keyer_csv_missing_column(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_CSV, .encoding = FIELD_ENC_UINT, .key_size = 8, .csv = {5, ','}};
+	u8 key[8];
+
+	TEST_ASSERT_FALSE(extract_str(&fk, "1,2,3", key));
+}
+
+// Test 4: Signed integers keep their order under memcmp
+void test_field_keyer_signed_order(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_CSV, .encoding = FIELD_ENC_INT, .key_size = 4, .csv = {0, ','}};
+	const char *recs[] = {"-2147483648", "-5", "-1", "0", "1", "42", "2147483647"};
+	u8 prev[4];
+	u8 key[4];
+
+	TEST_ASSERT_TRUE(extract_str(&fk, recs[0], prev));
+	for (size_t i = 1; i < sizeof(recs) / sizeof(recs[0]); i++) {
+		TEST_ASSERT_TRUE(extract_str(&fk, recs[i], key));
+		TEST_ASSERT_TRUE(memcmp(prev, key, 4) < 0);
+		memcpy(prev, key, 4);
+	}
+}
+
+// Test 5: Out of range values are clamped, not wrapped
+void test_field_keyer_clamp(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_CSV, .encoding = FIELD_ENC_UINT, .key_size = 2, .csv = {0, ','}};
+	u8 key[2];
+	u8 expected[2] = {0xff, 0xff};
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "70000", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, key, 2);
+}
+
+// Test 6: Nested JSON path, skipping unrelated values
+void test_field_keyer_json_nested(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_JSON, .encoding = FIELD_ENC_UINT, .key_size = 8, .json = {"req.ts"}};
+	u8 key[8];
+	u8 expected[8] = {0, 0, 0, 0, 0, 0, 0x01, 0x00};
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "{\"msg\":\"a,}\\\"b\",\"tags\":[1,{\"ts\":9}],\"req\":{\"id\":7,\"ts\":256}}", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, key, 8);
+}
+
+// Test 7: JSON string field and missing path
+void test_field_keyer_json_string(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_JSON, .encoding = FIELD_ENC_STRING, .key_size = 4, .json = {"level"}};
+	Field_Keyer missing = {.source = FIELD_SRC_JSON, .encoding = FIELD_ENC_STRING, .key_size = 4, .json = {"req.id"}};
+	u8 key[4];
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "{ \"level\" : \"error\" }", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY("erro", key, 4);
+	TEST_ASSERT_FALSE(extract_str(&missing, "{\"req\":5}", key));
+}
+
+// Test 8: JSON string escapes are decoded before encoding
+void test_field_keyer_json_escapes(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_JSON, .encoding = FIELD_ENC_STRING, .key_size = 6, .json = {"s"}};
+	u8 plain[6];
+	u8 key[6];
+
+	TEST_ASSERT_TRUE(extract_str(&fk, "{\"s\":\"Abc\"}", plain));
+	TEST_ASSERT_TRUE(extract_str(&fk, "{\"s\":\"\\u0041bc\"}", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(plain, key, 6);
+
+	u8 quote[6] = {'a', '"', '\\', '/', '\n', 0};
+	TEST_ASSERT_TRUE(extract_str(&fk, "{\"s\":\"a\\\"\\\\\\/\\n\"}", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(quote, key, 6);
+
+	// U+00E9 and U+1F600 (surrogate pair) as UTF-8
+	u8 utf8[6] = {0xc3, 0xa9, 0xf0, 0x9f, 0x98, 0x80};
+	TEST_ASSERT_TRUE(extract_str(&fk, "{\"s\":\"\\u00e9\\ud83d\\uDE00\"}", key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(utf8, key, 6);
+
+	TEST_ASSERT_FALSE(extract_str(&fk, "{\"s\":\"\\x41\"}", key));
+	TEST_ASSERT_FALSE(extract_str(&fk, "{\"s\":\"\\u12\"}", key));
+	TEST_ASSERT_FALSE(extract_str(&fk, "{\"s\":\"\\udc00\"}", key));
+}
+
+// Test 9: Little-endian signed binary field
+void test_field_keyer_binary_le_int(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_BINARY, .encoding = FIELD_ENC_INT, .key_size = 2, .binary = {2, 2, false}};
+	u8 rec[] = {0xaa, 0xbb, 0xfe, 0xff, 0xcc};  // -2 at offset 2
+	u8 key[2];
+	u8 expected[2] = {0x7f, 0xfe};
+	Indexer_In_Buffer buf = in_buf(rec, sizeof(rec));
+
+	TEST_ASSERT_TRUE(field_keyer_extract(&fk, &buf, 0, sizeof(rec), key));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, key, 2);
+}
+
+// Test 10: Binary field past the end of the record
+void test_field_keyer_binary_out_of_bounds(void) {
+	Field_Keyer fk = {.source = FIELD_SRC_BINARY, .encoding = FIELD_ENC_UINT, .key_size = 8, .binary = {4, 4, true}};
+	u8 rec[6] = {0};
+	Indexer_In_Buffer buf = in_buf(rec, sizeof(rec));
+
+	TEST_ASSERT_NULL(field_key_fn(&fk, &buf, 0, sizeof(rec)));
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_field_keyer_csv_uint);
+	RUN_TEST(test_field_keyer_csv_quoted_string);
+	RUN_TEST(test_field_keyer_csv_missing_column);
+	RUN_TEST(test_field_keyer_signed_order);
+	RUN_TEST(test_field_keyer_clamp);
+	RUN_TEST(test_field_keyer_json_nested);
+	RUN_TEST(test_field_keyer_json_string);
+	RUN_TEST(test_field_keyer_json_escapes);
+	RUN_TEST(test_field_keyer_binary_le_int);
+	RUN_TEST(test_field_keyer_binary_out_of_bounds);
+
+	return UNITY_END();
+}
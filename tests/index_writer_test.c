@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+#define KEY_SIZE 8
+#define HEADER_SIZE 21        // packed Indexer_Header_s
+#define HEADER_ENTRY_NUMS 12  // offset of entry_nums in the header
+#define BIG_BATCH ((5u << 20) / 32 + 7)  // just over 5 MiB of 32 byte entries
+
+static char tmpdir[] = "/tmp/indexer_writer_test_XXXXXX";
+static char cwd[4096];
+static Indexer_Ctx_s *ctx;
+static u64 entry_size;
+
+static u8 *make_entries(u64 n, u64 base_offset) {
+	u8 *entries = malloc(n * entry_size);
+	TEST_ASSERT_NOT_NULL(entries);
+	u8 key[KEY_SIZE];
+	for (u64 i = 0; i < n; i++) {
+		for (u64 j = 0; j < KEY_SIZE; j++) {
+			key[j] = rand() % 256;
+		}
+		indexer_entry_set((Indexer_Entry *)(entries + i * entry_size), base_offset + i, 1, key, KEY_SIZE);
+	}
+	return entries;
+}
+
+static u8 *read_file(const char *path, u64 *len) {
+	FILE *f = fopen(path, "rb");
+	TEST_ASSERT_NOT_NULL(f);
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	u8 *buf = malloc(*len + 1);
+	TEST_ASSERT_EQUAL_UINT64(*len, fread(buf, 1, *len, f));
+	fclose(f);
+	return buf;
+}
+
+static u64 header_entry_nums(const u8 *file) {
+	u64 n;
+	memcpy(&n, file + HEADER_ENTRY_NUMS, sizeof(n));
+	return n;
+}
+
+// Anything the writer left next to its targets.
+static int count_tmp_files(void) {
+	DIR *d = opendir(".");
+	TEST_ASSERT_NOT_NULL(d);
+	int n = 0;
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		n += strstr(de->d_name, ".tmp.") != NULL;
+	}
+	closedir(d);
+	return n;
+}
+
+static int remove_cb(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+	(void)sb;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+void setUp(void) {
+	TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+	strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+	TEST_ASSERT_NOT_NULL(mkdtemp(tmpdir));
+	TEST_ASSERT_EQUAL_INT(0, chdir(tmpdir));
+
+	ctx = indexer_ctx_new(KEY_SIZE, 0);
+	entry_size = indexer_entry_size(ctx);
+	indexer_ctx_set_entries(ctx, NULL, 0);
+}
+
+void tearDown(void) {
+	indexer_ctx_free(ctx);
+	TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+	nftw(tmpdir, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Test 1: Small and large appends produce the header followed by every entry in order
+void test_writer_mixed_batches(void) {
+	TEST_ASSERT_EQUAL_UINT64(32, entry_size);
+	const u64 sizes[] = {1, 3, BIG_BATCH, 100, 0, 70000, BIG_BATCH, 2};
+	const u64 nbatches = sizeof(sizes) / sizeof(sizes[0]);
+	u64 total = 0;
+	for (u64 i = 0; i < nbatches; i++) {
+		total += sizes[i];
+	}
+
+	srand(1);
+	u8 *expected = make_entries(total, 0);
+	Indexer_Writer *w = indexer_writer_open(ctx, "idx");
+	TEST_ASSERT_NOT_NULL(w);
+	u64 done = 0;
+	for (u64 i = 0; i < nbatches; i++) {
+		TEST_ASSERT_TRUE(indexer_writer_append(w, expected + done * entry_size, sizes[i]));
+		done += sizes[i];
+	}
+	TEST_ASSERT_NOT_EQUAL(0, access("idx", F_OK));  // nothing visible before commit
+	TEST_ASSERT_TRUE(indexer_writer_commit(w));
+
+	u64 len;
+	u8 *file = read_file("idx", &len);
+	TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE + total * entry_size, len);
+	TEST_ASSERT_EQUAL_UINT64(total, header_entry_nums(file));
+	TEST_ASSERT_EQUAL_MEMORY(expected, file + HEADER_SIZE, total * entry_size);
+	TEST_ASSERT_EQUAL_INT(0, count_tmp_files());
+	free(file);
+	free(expected);
+}
+
+// Test 2: The one shot writer matches the streaming one
+void test_writer_write_index(void) {
+	srand(2);
+	u8 *entries = make_entries(1000, 0);
+	indexer_ctx_set_entries(ctx, entries, 1000);
+	TEST_ASSERT_TRUE(indexer_write_index(ctx, "one_shot"));
+
+	Indexer_Writer *w = indexer_writer_open(ctx, "streamed");
+	TEST_ASSERT_NOT_NULL(w);
+	TEST_ASSERT_TRUE(indexer_writer_append(w, entries, 400));
+	TEST_ASSERT_TRUE(indexer_writer_append(w, entries + 400 * entry_size, 600));
+	TEST_ASSERT_TRUE(indexer_writer_commit(w));
+
+	u64 a_len, b_len;
+	u8 *a = read_file("one_shot", &a_len);
+	u8 *b = read_file("streamed", &b_len);
+	TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE + 1000 * entry_size, a_len);
+	TEST_ASSERT_EQUAL_UINT64(a_len, b_len);
+	TEST_ASSERT_EQUAL_MEMORY(a, b, a_len);
+	TEST_ASSERT_EQUAL_UINT64(1000, header_entry_nums(a));
+	free(a);
+	free(b);
+	free(entries);
+}
+
+// Test 3: Abort leaves neither the target nor a temp file
+void test_writer_abort(void) {
+	srand(3);
+	u8 *entries = make_entries(BIG_BATCH, 0);
+	Indexer_Writer *w = indexer_writer_open(ctx, "aborted");
+	TEST_ASSERT_NOT_NULL(w);
+	TEST_ASSERT_TRUE(indexer_writer_append(w, entries, 10));
+	TEST_ASSERT_TRUE(indexer_writer_append(w, entries, BIG_BATCH));
+	TEST_ASSERT_EQUAL_INT(1, count_tmp_files());
+	indexer_writer_abort(w);
+
+	TEST_ASSERT_EQUAL_INT(0, count_tmp_files());
+	TEST_ASSERT_NOT_EQUAL(0, access("aborted", F_OK));
+	free(entries);
+}
+
+// Test 4: Commit replaces an existing file and keeps its mode
+void test_writer_replace(void) {
+	srand(4);
+	u8 *entries = make_entries(10, 0);
+	indexer_ctx_set_entries(ctx, entries, 10);
+	TEST_ASSERT_TRUE(indexer_write_index(ctx, "idx"));
+	TEST_ASSERT_EQUAL_INT(0, chmod("idx", 0600));
+
+	indexer_ctx_set_entries(ctx, entries, 3);
+	TEST_ASSERT_TRUE(indexer_write_index(ctx, "idx"));
+	struct stat st;
+	TEST_ASSERT_EQUAL_INT(0, stat("idx", &st));
+	TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE + 3 * entry_size, st.st_size);
+	TEST_ASSERT_EQUAL_INT(0600, st.st_mode & 07777);
+	TEST_ASSERT_EQUAL_INT(0, count_tmp_files());
+	free(entries);
+}
+
+// Test 5: New files follow the umask
+void test_writer_umask(void) {
+	mode_t old = umask(027);
+	TEST_ASSERT_TRUE(indexer_write_index(ctx, "empty"));
+	umask(old);
+
+	struct stat st;
+	TEST_ASSERT_EQUAL_INT(0, stat("empty", &st));
+	TEST_ASSERT_EQUAL_INT(0640, st.st_mode & 07777);
+	TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE, st.st_size);
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_writer_mixed_batches);
+	RUN_TEST(test_writer_write_index);
+	RUN_TEST(test_writer_abort);
+	RUN_TEST(test_writer_replace);
+	RUN_TEST(test_writer_umask);
+
+	return UNITY_END();
+}
@@ -0,0 +1,121 @@
+// tests/key_kernels_benchmark.c
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "indexer.h"
+#include "util.h"
+
+// Helper function to generate random entries
+static void generate_random_entries(u8 *entries, u64 n, u64 entry_size, u64 key_size, unsigned int seed) {
+	u8 key[32];
+	srand(seed);
+	for (u64 i = 0; i < n; i++) {
+		for (u64 j = 0; j < key_size; j++) {
+			key[j] = rand() % 256;
+		}
+		indexer_entry_set((Indexer_Entry *)(entries + i * entry_size), i, 0, key, key_size);
+	}
+}
+
+// Helper function to measure time
+static double get_time_diff(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+typedef struct Bench_Result {
+	double sort_time;
+	double lookup_time;
+} Bench_Result;
+
+static Bench_Result run(Indexer_Ctx_s *ctx, u8 *entries, u64 n, u64 lookups, bool generic) {
+	u64 entry_size = indexer_entry_size(ctx);
+	u64 key_size = indexer_key_size(ctx);
+	struct timespec start, end;
+	Bench_Result r;
+
+	generate_random_entries(entries, n, entry_size, key_size, 12345);
+	indexer_ctx_set_entries(ctx, entries, n);
+	if (generic) {
+		indexer_bind_generic_kernels(ctx);
+	} else {
+		indexer_bind_kernels(ctx);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	indexer_sort_entries(ctx);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	r.sort_time = get_time_diff(start, end);
+
+	// Probe with keys that are in the index, spread over it
+	u64 found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (u64 i = 0; i < lookups; i++) {
+		const u8 *key = indexer_entry_key((const Indexer_Entry *)(entries + ((i * 7919) % n) * entry_size));
+		found += indexer_range_scan(ctx, key, key, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	r.lookup_time = get_time_diff(start, end);
+
+	if (found < lookups) {
+		fprintf(stderr, "lookup missed keys %lu\n", lookups - found);
+	}
+	return r;
+}
+
+// Benchmark function
+static void benchmark_key_kernels(u64 key_size, u8 descriptor, u64 n, u64 lookups) {
+	Indexer_Ctx_s *ctx = indexer_ctx_new(key_size, descriptor);
+	if (!ctx) {
+		fprintf(stderr, "Memory allocation failed\n");
+		return;
+	}
+	u8 *entries = malloc(n * indexer_entry_size(ctx));
+	if (!entries) {
+		fprintf(stderr, "Memory allocation failed\n");
+		indexer_ctx_free(ctx);
+		return;
+	}
+
+	indexer_bind_kernels(ctx);
+	printf("Benchmarking %s kernels with %lu entries, %lu lookups\n", indexer_kernels_name(ctx), n, lookups);
+
+	Bench_Result specialized = run(ctx, entries, n, lookups, false);
+	Bench_Result generic = run(ctx, entries, n, lookups, true);
+
+	printf("  Sort:   %.6f s (generic %.6f s, %.2fx)\n", specialized.sort_time, generic.sort_time,
+	       generic.sort_time / specialized.sort_time);
+	printf("  Lookup: %.6f s (generic %.6f s, %.2fx)\n", specialized.lookup_time, generic.lookup_time,
+	       generic.lookup_time / specialized.lookup_time);
+	printf("\n");
+
+	free(entries);
+	indexer_ctx_free(ctx);
+}
+
+int main(void) {
+	printf("Key Kernels Performance Benchmark\n");
+	printf("=================================\n\n");
+
+	struct test_case {
+		u64 key_size;
+		u8 descriptor;
+	};
+	struct test_case tcs[] = {
+	    {4, 0},
+	    {8, 0},
+	    {16, 0},
+	    {4, DESC_WITH_CHECKSUM},
+	    {8, DESC_WITH_CHECKSUM},
+	    {16, DESC_WITH_CHECKSUM},
+	};
+
+	size_t num_tests = sizeof(tcs) / sizeof(tcs[0]);
+	for (size_t i = 0; i < num_tests; i++) {
+		benchmark_key_kernels(tcs[i].key_size, tcs[i].descriptor, 2000000, 1000000);
+	}
+
+	return 0;
+}
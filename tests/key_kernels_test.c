@@ -0,0 +1,202 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+#define ENTRIES 3000
+#define DISTINCT 400
+
+typedef struct Kernel_Case {
+	u64 key_size;
+	u8 descriptor;
+	const char *kernel;
+} Kernel_Case;
+
+static Indexer_Ctx_s *ctx;
+static u64 key_size;
+static u64 entry_size;
+static u8 *entries;
+static u8 *original;
+
+// Key number v maps to a fixed pseudo random key, 0 and 1 are all 0x00 / all 0xff.
+static void make_key(u8 *key, u32 v) {
+	u32 x = v * 2654435761u + 1;
+	for (u64 j = 0; j < key_size; j++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		key[j] = v == 0 ? 0x00 : v == 1 ? 0xff : (u8)x;
+	}
+}
+
+static u8 *entry_at(u8 *base, u64 i) {
+	return base + i * entry_size;
+}
+
+static const u8 *key_at(u8 *base, u64 i) {
+	return indexer_entry_key((const Indexer_Entry *)entry_at(base, i));
+}
+
+// Entry i gets key number rand() % DISTINCT, offset i and a checksum trailer
+// (when present) derived from i, so moved entries can be checked whole.
+static void setup_case(const Kernel_Case *kc) {
+	ctx = indexer_ctx_new(kc->key_size, kc->descriptor);
+	key_size = indexer_key_size(ctx);
+	entry_size = indexer_entry_size(ctx);
+	entries = malloc(ENTRIES * entry_size);
+	original = malloc(ENTRIES * entry_size);
+
+	srand(kc->key_size * 2 + kc->descriptor);
+	u8 key[32];
+	for (u64 i = 0; i < ENTRIES; i++) {
+		make_key(key, rand() % DISTINCT);
+		u8 *e = entry_at(entries, i);
+		indexer_entry_set((Indexer_Entry *)e, i, i * 3, key, key_size);
+		for (u64 j = (key_at(entries, i) - e) + key_size; j < entry_size; j++) {
+			e[j] = (u8)(i + j);
+		}
+	}
+	memcpy(original, entries, ENTRIES * entry_size);
+	indexer_ctx_set_entries(ctx, entries, ENTRIES);
+}
+
+static void teardown_case(void) {
+	indexer_ctx_free(ctx);
+	free(entries);
+	free(original);
+}
+
+static void check_sorted(void) {
+	for (u64 i = 0; i < ENTRIES; i++) {
+		u64 offset = indexer_entry_offset((const Indexer_Entry *)entry_at(entries, i));
+		TEST_ASSERT_TRUE(offset < ENTRIES);
+		// the entry moved as a whole
+		TEST_ASSERT_EQUAL_MEMORY(entry_at(original, offset), entry_at(entries, i), entry_size);
+		if (i > 0) {
+			int cmp = memcmp(key_at(entries, i - 1), key_at(entries, i), key_size);
+			TEST_ASSERT_TRUE(cmp <= 0);
+			if (cmp == 0) {
+				// stable
+				TEST_ASSERT_TRUE(indexer_entry_offset((const Indexer_Entry *)entry_at(entries, i - 1)) < offset);
+			}
+		}
+	}
+}
+
+static void check_bounds(const u8 *probe) {
+	u64 lower = 0;
+	u64 equal = 0;
+	for (u64 i = 0; i < ENTRIES; i++) {
+		int cmp = memcmp(key_at(entries, i), probe, key_size);
+		lower += cmp < 0;
+		equal += cmp == 0;
+	}
+
+	Indexer_Entry *first = NULL;
+	u64 n = indexer_range_scan(ctx, probe, probe, &first);
+	TEST_ASSERT_EQUAL_UINT64(equal, n);
+	if (equal > 0) {
+		TEST_ASSERT_EQUAL_PTR(entry_at(entries, lower), first);
+	} else {
+		TEST_ASSERT_NULL(first);
+	}
+}
+
+static void run_case(const Kernel_Case *kc) {
+	setup_case(kc);
+	TEST_ASSERT_EQUAL_STRING(kc->kernel, indexer_kernels_name(ctx));
+
+	TEST_ASSERT_TRUE(indexer_sort_entries(ctx));
+	check_sorted();
+
+	u8 probe[32];
+	for (u32 v = 0; v < DISTINCT + 50; v++) {  // the last 50 are absent
+		make_key(probe, v);
+		check_bounds(probe);
+	}
+	memset(probe, 0x80, key_size);
+	check_bounds(probe);
+
+	// The generic kernel must produce the exact same layout.
+	u8 *specialized = malloc(ENTRIES * entry_size);
+	memcpy(specialized, entries, ENTRIES * entry_size);
+	memcpy(entries, original, ENTRIES * entry_size);
+	indexer_bind_generic_kernels(ctx);
+	TEST_ASSERT_TRUE(indexer_sort_entries(ctx));
+	TEST_ASSERT_EQUAL_MEMORY(specialized, entries, ENTRIES * entry_size);
+	make_key(probe, 7);
+	check_bounds(probe);
+	free(specialized);
+
+	teardown_case();
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// Test 1: 4 byte keys (xxhash32)
+void test_key_kernels_k32(void) {
+	Kernel_Case kc = {4, 0, "k32"};
+	run_case(&kc);
+}
+
+void test_key_kernels_k32_checksum(void) {
+	Kernel_Case kc = {4, DESC_WITH_CHECKSUM, "k32_checksum"};
+	run_case(&kc);
+}
+
+// Test 2: 8 byte keys (xxhash64, XXH3)
+void test_key_kernels_k64(void) {
+	Kernel_Case kc = {8, 0, "k64"};
+	run_case(&kc);
+}
+
+void test_key_kernels_k64_checksum(void) {
+	Kernel_Case kc = {8, DESC_WITH_CHECKSUM, "k64_checksum"};
+	run_case(&kc);
+}
+
+// Test 3: 16 byte keys (xxhash128)
+void test_key_kernels_k128(void) {
+	Kernel_Case kc = {16, 0, "k128"};
+	run_case(&kc);
+}
+
+void test_key_kernels_k128_checksum(void) {
+	Kernel_Case kc = {16, DESC_WITH_CHECKSUM, "k128_checksum"};
+	run_case(&kc);
+}
+
+// Test 4: Other widths fall back to the generic kernel
+void test_key_kernels_generic(void) {
+	Kernel_Case kc = {5, 0, "generic"};
+	run_case(&kc);
+}
+
+void test_key_kernels_generic_checksum(void) {
+	Kernel_Case kc = {5, DESC_WITH_CHECKSUM, "generic"};
+	run_case(&kc);
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_key_kernels_k32);
+	RUN_TEST(test_key_kernels_k32_checksum);
+	RUN_TEST(test_key_kernels_k64);
+	RUN_TEST(test_key_kernels_k64_checksum);
+	RUN_TEST(test_key_kernels_k128);
+	RUN_TEST(test_key_kernels_k128_checksum);
+	RUN_TEST(test_key_kernels_generic);
+	RUN_TEST(test_key_kernels_generic_checksum);
+
+	return UNITY_END();
+}
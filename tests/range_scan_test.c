@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+#define KEY_SIZE 4
+
+static Indexer_Ctx_s *ctx;
+static u8 *entries;
+static u64 entry_size;
+
+// Sorted keys with duplicates, entry offset is its position.
+static const u32 keys[] = {3, 5, 5, 5, 9, 12, 12, 40};
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+
+static void be32(u8 *out, u32 v) {
+	out[0] = v >> 24;
+	out[1] = v >> 16;
+	out[2] = v >> 8;
+	out[3] = v;
+}
+
+static u64 scan(u32 lo, u32 hi, u64 *first_offset) {
+	u8 lo_key[KEY_SIZE];
+	u8 hi_key[KEY_SIZE];
+	be32(lo_key, lo);
+	be32(hi_key, hi);
+	Indexer_Entry *first = (Indexer_Entry *)entries;  // must be overwritten
+	u64 n = indexer_range_scan(ctx, lo_key, hi_key, &first);
+	if (first_offset) {
+		*first_offset = first ? indexer_entry_offset(first) : UINT64_MAX;
+	}
+	return n;
+}
+
+void setUp(void) {
+	ctx = indexer_ctx_new(KEY_SIZE, 0);
+	entry_size = indexer_entry_size(ctx);
+	entries = malloc(NKEYS * entry_size);
+	for (u64 i = 0; i < NKEYS; i++) {
+		u8 key[KEY_SIZE];
+		be32(key, keys[i]);
+		indexer_entry_set((Indexer_Entry *)(entries + i * entry_size), i, 1, key, KEY_SIZE);
+	}
+	indexer_ctx_set_entries(ctx, entries, NKEYS);
+}
+
+void tearDown(void) {
+	indexer_ctx_free(ctx);
+	free(entries);
+}
+
+// Test 1: Range between two keys matches nothing
+void test_range_scan_empty_range(void) {
+	u64 first;
+
+	TEST_ASSERT_EQUAL_UINT64(0, scan(6, 8, &first));
+	TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, first);
+	TEST_ASSERT_EQUAL_UINT64(0, scan(41, 100, &first));
+	TEST_ASSERT_EQUAL_UINT64(0, scan(0, 2, &first));
+}
+
+// Test 2: lo > hi matches nothing
+void test_range_scan_inverted_bounds(void) {
+	u64 first;
+
+	TEST_ASSERT_EQUAL_UINT64(0, scan(12, 3, &first));
+	TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, first);
+}
+
+// Test 3: lo == hi returns every duplicate
+void test_range_scan_point_duplicates(void) {
+	u64 first;
+
+	TEST_ASSERT_EQUAL_UINT64(3, scan(5, 5, &first));
+	TEST_ASSERT_EQUAL_UINT64(1, first);
+	TEST_ASSERT_EQUAL_UINT64(1, scan(40, 40, &first));
+	TEST_ASSERT_EQUAL_UINT64(7, first);
+}
+
+// Test 4: Bounds are inclusive on both ends
+void test_range_scan_inclusive_bounds(void) {
+	u64 first;
+
+	TEST_ASSERT_EQUAL_UINT64(6, scan(5, 12, &first));
+	TEST_ASSERT_EQUAL_UINT64(1, first);
+	TEST_ASSERT_EQUAL_UINT64(4, scan(4, 9, &first));
+	TEST_ASSERT_EQUAL_UINT64(1, first);
+}
+
+// Test 5: Range covering everything
+void test_range_scan_everything(void) {
+	u64 first;
+
+	TEST_ASSERT_EQUAL_UINT64(NKEYS, scan(0, UINT32_MAX, &first));
+	TEST_ASSERT_EQUAL_UINT64(0, first);
+	TEST_ASSERT_EQUAL_UINT64(NKEYS, scan(3, 40, &first));
+}
+
+// Test 6: Empty index
+void test_range_scan_no_entries(void) {
+	u64 first;
+
+	indexer_ctx_set_entries(ctx, entries, 0);
+	TEST_ASSERT_EQUAL_UINT64(0, scan(0, UINT32_MAX, NULL));
+
+	indexer_ctx_set_entries(ctx, NULL, 0);
+	TEST_ASSERT_EQUAL_UINT64(0, scan(0, UINT32_MAX, &first));
+	TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, first);
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_range_scan_empty_range);
+	RUN_TEST(test_range_scan_inverted_bounds);
+	RUN_TEST(test_range_scan_point_duplicates);
+	RUN_TEST(test_range_scan_inclusive_bounds);
+	RUN_TEST(test_range_scan_everything);
+	RUN_TEST(test_range_scan_no_entries);
+
+	return UNITY_END();
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+#define KEY_SIZE 8
+#define ENTRIES 5000
+
+// Manifest header field offsets, see Indexer_Manifest_Header_s
+#define MANIFEST_KEY_SIZE_OFF 8
+#define MANIFEST_ENTRY_SIZE_OFF 16
+#define MANIFEST_SHARDS_OFF 37  // first shard record: u64 entry_nums, min key, max key, ...
+
+static char tmpdir[] = "/tmp/indexer_shard_test_XXXXXX";
+static char cwd[4096];
+static Indexer_Ctx_s *ctx;
+static u8 *entries;
+static u64 entry_size;
+static u64 offset_base;  // entry i gets offset offset_base + i
+
+static const u8 *key_at(u64 i) {
+	return indexer_entry_key((const Indexer_Entry *)(entries + i * entry_size));
+}
+
+static void fill_entries(u64 n) {
+	u8 key[KEY_SIZE];
+	srand(42);
+	for (u64 i = 0; i < n; i++) {
+		for (u64 j = 0; j < KEY_SIZE; j++) {
+			key[j] = rand() % 256;
+		}
+		if (i % 10 == 9) {
+			memcpy(key, key_at(i - 1), KEY_SIZE);  // duplicates
+		}
+		indexer_entry_set((Indexer_Entry *)(entries + i * entry_size), offset_base + i, 1, key, KEY_SIZE);
+	}
+	indexer_ctx_set_entries(ctx, entries, n);
+}
+
+// Every key is found, with all its duplicates, in its shard.
+static void check_lookups(Indexer_Shards *shards, u64 n) {
+	for (u64 i = 0; i < n; i++) {
+		u64 expected = 0;
+		for (u64 j = 0; j < n; j++) {
+			expected += memcmp(key_at(i), key_at(j), KEY_SIZE) == 0;
+		}
+
+		Indexer_Entry *first = NULL;
+		u64 found = indexer_shards_lookup(shards, key_at(i), &first);
+		TEST_ASSERT_EQUAL_UINT64(expected, found);
+
+		bool seen = false;
+		for (u64 j = 0; j < found; j++) {
+			const Indexer_Entry *e = (const Indexer_Entry *)((const u8 *)first + j * entry_size);
+			TEST_ASSERT_EQUAL_MEMORY(key_at(i), indexer_entry_key(e), KEY_SIZE);
+			seen |= indexer_entry_offset(e) == offset_base + i;
+		}
+		TEST_ASSERT_TRUE(seen);
+	}
+}
+
+static void patch_u64(const char *path, long off, u64 v) {
+	FILE *f = fopen(path, "r+b");
+	TEST_ASSERT_NOT_NULL(f);
+	fseek(f, off, SEEK_SET);
+	fwrite(&v, sizeof(v), 1, f);
+	fclose(f);
+}
+
+static void copy_file(const char *from, const char *to) {
+	char buf[4096];
+	FILE *in = fopen(from, "rb");
+	FILE *out = fopen(to, "wb");
+	TEST_ASSERT_NOT_NULL(in);
+	TEST_ASSERT_NOT_NULL(out);
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		TEST_ASSERT_EQUAL_UINT64(n, fwrite(buf, 1, n, out));
+	}
+	fclose(in);
+	fclose(out);
+}
+
+static int remove_cb(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+	(void)sb;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+void setUp(void) {
+	TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+	strcpy(tmpdir + strlen(tmpdir) - 6, "XXXXXX");
+	TEST_ASSERT_NOT_NULL(mkdtemp(tmpdir));
+	TEST_ASSERT_EQUAL_INT(0, chdir(tmpdir));
+
+	ctx = indexer_ctx_new(KEY_SIZE, 0);
+	entry_size = indexer_entry_size(ctx);
+	entries = malloc(ENTRIES * entry_size);
+	offset_base = 0;
+	fill_entries(ENTRIES);
+}
+
+void tearDown(void) {
+	indexer_ctx_free(ctx);
+	free(entries);
+	TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+	nftw(tmpdir, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Test 1: Write, reopen and find every key
+void test_shards_round_trip(void) {
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 3, NULL, 0));
+
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, ENTRIES);
+	indexer_shards_close(shards);
+}
+
+// Test 2: A single shard
+void test_shards_zero_bits(void) {
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 0, NULL, 0));
+
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, ENTRIES);
+	indexer_shards_close(shards);
+}
+
+// Test 3: Shards spread over relative and absolute directories
+void test_shards_dirs(void) {
+	char abs_dir[sizeof(tmpdir) + 8];
+	snprintf(abs_dir, sizeof(abs_dir), "%s/abs", tmpdir);
+	TEST_ASSERT_EQUAL_INT(0, mkdir("sub", 0755));
+	TEST_ASSERT_EQUAL_INT(0, mkdir("sub/d0", 0755));
+	TEST_ASSERT_EQUAL_INT(0, mkdir(abs_dir, 0755));
+	const char *dirs[] = {"d0", abs_dir};
+
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "sub/man", 2, dirs, 2));
+	TEST_ASSERT_EQUAL_INT(0, access("sub/d0/man.0.0", F_OK));
+	TEST_ASSERT_EQUAL_INT(0, access("abs/man.0.1", F_OK));
+
+	Indexer_Shards *shards = indexer_shards_open("sub/man");
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, ENTRIES);
+	indexer_shards_close(shards);
+}
+
+// Test 4: Shard paths resolve against the manifest, not the working directory
+void test_shards_relative_to_manifest(void) {
+	char abs_manifest[sizeof(tmpdir) + 16];
+	snprintf(abs_manifest, sizeof(abs_manifest), "%s/sub/man", tmpdir);
+	TEST_ASSERT_EQUAL_INT(0, mkdir("sub", 0755));
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "sub/man", 2, NULL, 0));
+
+	TEST_ASSERT_EQUAL_INT(0, chdir("sub"));
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	indexer_shards_close(shards);
+
+	TEST_ASSERT_EQUAL_INT(0, chdir("/"));
+	shards = indexer_shards_open(abs_manifest);
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, ENTRIES);
+	indexer_shards_close(shards);
+	TEST_ASSERT_EQUAL_INT(0, chdir(tmpdir));
+
+	// the whole directory can be moved
+	TEST_ASSERT_EQUAL_INT(0, rename("sub", "moved"));
+	shards = indexer_shards_open("moved/man");
+	TEST_ASSERT_NOT_NULL(shards);
+	indexer_shards_close(shards);
+}
+
+// Test 5: Mostly empty shards, and an index with no entries at all
+void test_shards_empty(void) {
+	fill_entries(10);
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 8, NULL, 0));
+
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, 10);
+	u8 absent[KEY_SIZE];
+	memcpy(absent, key_at(0), KEY_SIZE);
+	absent[KEY_SIZE - 1] ^= 0x5a;
+	TEST_ASSERT_EQUAL_UINT64(0, indexer_shards_lookup(shards, absent, NULL));
+	Indexer_Entry *first = (Indexer_Entry *)entries;
+	TEST_ASSERT_EQUAL_UINT64(0, indexer_shards_lookup(shards, NULL, &first));
+	TEST_ASSERT_NULL(first);
+	indexer_shards_close(shards);
+
+	indexer_ctx_set_entries(ctx, entries, 0);
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "none", 2, NULL, 0));
+	shards = indexer_shards_open("none");
+	TEST_ASSERT_NOT_NULL(shards);
+	TEST_ASSERT_EQUAL_UINT64(0, indexer_shards_lookup(shards, absent, NULL));
+	indexer_shards_close(shards);
+}
+
+// Test 6: Corrupt or inconsistent manifests are rejected
+void test_shards_corrupt_manifest(void) {
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 2, NULL, 0));
+	struct stat st;
+	TEST_ASSERT_EQUAL_INT(0, stat("man", &st));
+
+	// key_size that does not match entry_size
+	patch_u64("man", MANIFEST_KEY_SIZE_OFF, 4);
+	TEST_ASSERT_NULL(indexer_shards_open("man"));
+	patch_u64("man", MANIFEST_KEY_SIZE_OFF, KEY_SIZE);
+
+	// entry_size too small to hold the key
+	patch_u64("man", MANIFEST_ENTRY_SIZE_OFF, 16);
+	TEST_ASSERT_NULL(indexer_shards_open("man"));
+	patch_u64("man", MANIFEST_ENTRY_SIZE_OFF, entry_size);
+
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	indexer_shards_close(shards);
+
+	// min key of shard 0 that is not its first key
+	patch_u64("man", MANIFEST_SHARDS_OFF + sizeof(u64), 0);
+	TEST_ASSERT_NULL(indexer_shards_open("man"));
+
+	// truncated
+	TEST_ASSERT_EQUAL_INT(0, truncate("man", st.st_size - 3));
+	TEST_ASSERT_NULL(indexer_shards_open("man"));
+
+	// bad magic
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 2, NULL, 0));
+	patch_u64("man", 0, 0);
+	TEST_ASSERT_NULL(indexer_shards_open("man"));
+
+	// missing shard
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "fresh", 2, NULL, 0));
+	TEST_ASSERT_EQUAL_INT(0, unlink("fresh.0.3"));
+	TEST_ASSERT_NULL(indexer_shards_open("fresh"));
+
+	TEST_ASSERT_NULL(indexer_shards_open("does_not_exist"));
+}
+
+// Test 7: A rebuild never touches the shards of the manifest it replaces
+void test_shards_rebuild(void) {
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 2, NULL, 0));
+	copy_file("man", "old");
+	Indexer_Shards *pinned = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(pinned);
+
+	// Same keys, so every shard keeps its entry count, but new offsets.
+	offset_base = ENTRIES;
+	fill_entries(ENTRIES);
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 2, NULL, 0));
+	TEST_ASSERT_EQUAL_INT(0, access("man.1.0", F_OK));
+	TEST_ASSERT_NOT_EQUAL(0, access("man.0.0", F_OK));
+
+	// The old manifest's shards are gone, it must not open the new ones instead.
+	TEST_ASSERT_NULL(indexer_shards_open("old"));
+
+	Indexer_Shards *shards = indexer_shards_open("man");
+	TEST_ASSERT_NOT_NULL(shards);
+	check_lookups(shards, ENTRIES);
+	indexer_shards_close(shards);
+
+	// Already mapped shards survive the unlink.
+	offset_base = 0;
+	fill_entries(ENTRIES);
+	check_lookups(pinned, ENTRIES);
+	indexer_shards_close(pinned);
+}
+
+// Test 8: A failed rebuild leaves the previous index openable
+void test_shards_failed_rebuild(void) {
+	TEST_ASSERT_TRUE(indexer_write_sharded(ctx, "man", 2, NULL, 0));
+	copy_file("man", "old");
+
+	// Shards 1 and 3 go to a directory that does not exist.
+	const char *dirs[] = {".", "missing"};
+	offset_base = ENTRIES;
+	fill_entries(ENTRIES);
+	TEST_ASSERT_FALSE(indexer_write_sharded(ctx, "man", 2, dirs, 2));
+	TEST_ASSERT_NOT_EQUAL(0, access("man.1.0", F_OK));
+	TEST_ASSERT_NOT_EQUAL(0, access("man.1.2", F_OK));
+
+	offset_base = 0;
+	fill_entries(ENTRIES);
+	const char *manifests[] = {"man", "old"};
+	for (int m = 0; m < 2; m++) {
+		Indexer_Shards *shards = indexer_shards_open(manifests[m]);
+		TEST_ASSERT_NOT_NULL(shards);
+		check_lookups(shards, ENTRIES);
+		indexer_shards_close(shards);
+	}
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_shards_round_trip);
+	RUN_TEST(test_shards_zero_bits);
+	RUN_TEST(test_shards_dirs);
+	RUN_TEST(test_shards_relative_to_manifest);
+	RUN_TEST(test_shards_empty);
+	RUN_TEST(test_shards_corrupt_manifest);
+	RUN_TEST(test_shards_rebuild);
+	RUN_TEST(test_shards_failed_rebuild);
+
+	return UNITY_END();
+}
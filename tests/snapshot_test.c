@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexer.h"
+#include "unity.h"
+#include "util.h"
+
+#define KEY_SIZE 8
+#define READERS 4
+#define APPENDS 2000
+#define MAX_BATCH 64
+
+static Indexer_Ctx_s *ctx;
+static u64 entry_size;
+static atomic_bool done;
+
+// Readers cannot assert from their own threads, they count problems instead.
+typedef struct Reader_Stats {
+	u64 iterations;
+	u64 went_backward;
+	u64 count_mismatch;
+	u64 unsorted;
+} Reader_Stats;
+
+typedef struct Scan_State {
+	u64 seen;
+	u64 unsorted;
+} Scan_State;
+
+static void fill_random(u8 *entries, u64 n, u64 base_offset) {
+	u8 key[KEY_SIZE];
+	for (u64 i = 0; i < n; i++) {
+		for (u64 j = 0; j < KEY_SIZE; j++) {
+			key[j] = rand() % 256;
+		}
+		indexer_entry_set((Indexer_Entry *)(entries + i * entry_size), base_offset + i, 1, key, KEY_SIZE);
+	}
+}
+
+static void check_run(const Indexer_Entry *first, u64 count, u64 es, void *arg) {
+	Scan_State *st = arg;
+	const u8 *base = (const u8 *)first;
+	for (u64 i = 1; i < count; i++) {
+		const u8 *prev = indexer_entry_key((const Indexer_Entry *)(base + (i - 1) * es));
+		const u8 *cur = indexer_entry_key((const Indexer_Entry *)(base + i * es));
+		if (memcmp(prev, cur, KEY_SIZE) > 0) {
+			st->unsorted++;
+		}
+	}
+	st->seen += count;
+}
+
+static void *reader_main(void *arg) {
+	Reader_Stats *stats = arg;
+	Indexer_Reader *reader = indexer_reader_register(ctx);
+	if (!reader) {
+		stats->count_mismatch++;
+		return NULL;
+	}
+	u8 lo[KEY_SIZE];
+	u8 hi[KEY_SIZE];
+	memset(lo, 0x00, KEY_SIZE);
+	memset(hi, 0xff, KEY_SIZE);
+
+	u64 last = 0;
+	while (!atomic_load(&done)) {
+		const Indexer_Snapshot *snap = indexer_snapshot_pin(reader);
+		u64 n = indexer_snapshot_entry_nums(snap);
+		Scan_State st = {0, 0};
+		u64 scanned = indexer_snapshot_range_scan(snap, lo, hi, check_run, &st);
+		indexer_snapshot_unpin(reader);
+
+		stats->went_backward += n < last;
+		stats->count_mismatch += scanned != n || st.seen != n;
+		stats->unsorted += st.unsorted;
+		stats->iterations++;
+		last = n;
+	}
+	indexer_reader_unregister(reader);
+	return NULL;
+}
+
+void setUp(void) {
+	ctx = indexer_ctx_new(KEY_SIZE, 0);
+	entry_size = indexer_entry_size(ctx);
+	atomic_store(&done, false);
+}
+
+void tearDown(void) {
+	indexer_ctx_free(ctx);
+}
+
+// Test 1: Initial snapshot holds the sorted initial entries
+void test_snapshot_initial(void) {
+	u8 *entries = malloc(100 * entry_size);
+	srand(1);
+	fill_random(entries, 100, 0);
+	indexer_ctx_set_entries(ctx, entries, 100);
+	TEST_ASSERT_TRUE(indexer_live_init(ctx));
+	free(entries);  // the snapshot owns a copy
+
+	Indexer_Reader *reader = indexer_reader_register(ctx);
+	TEST_ASSERT_NOT_NULL(reader);
+	const Indexer_Snapshot *snap = indexer_snapshot_pin(reader);
+	u8 lo[KEY_SIZE] = {0};
+	u8 hi[KEY_SIZE];
+	memset(hi, 0xff, KEY_SIZE);
+	Scan_State st = {0, 0};
+	TEST_ASSERT_EQUAL_UINT64(100, indexer_snapshot_entry_nums(snap));
+	TEST_ASSERT_EQUAL_UINT64(100, indexer_snapshot_range_scan(snap, lo, hi, check_run, &st));
+	TEST_ASSERT_EQUAL_UINT64(0, st.unsorted);
+	indexer_snapshot_unpin(reader);
+	indexer_reader_unregister(reader);
+}
+
+// Test 2: A pinned snapshot does not change under appends
+void test_snapshot_isolation(void) {
+	TEST_ASSERT_TRUE(indexer_live_init(ctx));
+	u8 *batch = malloc(10 * entry_size);
+	srand(2);
+	fill_random(batch, 10, 0);
+	TEST_ASSERT_TRUE(indexer_append_entries(ctx, batch, 10));
+
+	Indexer_Reader *reader = indexer_reader_register(ctx);
+	const Indexer_Snapshot *snap = indexer_snapshot_pin(reader);
+	for (int i = 0; i < 20; i++) {
+		fill_random(batch, 10, 10 + i * 10);
+		TEST_ASSERT_TRUE(indexer_append_entries(ctx, batch, 10));
+	}
+	u8 lo[KEY_SIZE] = {0};
+	u8 hi[KEY_SIZE];
+	memset(hi, 0xff, KEY_SIZE);
+	TEST_ASSERT_EQUAL_UINT64(10, indexer_snapshot_entry_nums(snap));
+	TEST_ASSERT_EQUAL_UINT64(10, indexer_snapshot_range_scan(snap, lo, hi, NULL, NULL));
+	indexer_snapshot_unpin(reader);
+
+	snap = indexer_snapshot_pin(reader);
+	TEST_ASSERT_EQUAL_UINT64(210, indexer_snapshot_range_scan(snap, lo, hi, NULL, NULL));
+	indexer_snapshot_unpin(reader);
+	indexer_reader_unregister(reader);
+	free(batch);
+}
+
+// Test 3: Readers pin, scan and unpin while a writer keeps appending
+void test_snapshot_concurrent_readers(void) {
+	TEST_ASSERT_TRUE(indexer_live_init(ctx));
+
+	pthread_t threads[READERS];
+	Reader_Stats stats[READERS];
+	memset(stats, 0, sizeof(stats));
+	for (int i = 0; i < READERS; i++) {
+		TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, reader_main, &stats[i]));
+	}
+
+	u8 *batch = malloc(MAX_BATCH * entry_size);
+	u64 total = 0;
+	srand(3);
+	for (int i = 0; i < APPENDS; i++) {
+		u64 n = 1 + rand() % MAX_BATCH;
+		fill_random(batch, n, total);
+		TEST_ASSERT_TRUE(indexer_append_entries(ctx, batch, n));
+		total += n;
+	}
+	atomic_store(&done, true);
+	for (int i = 0; i < READERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(batch);
+
+	for (int i = 0; i < READERS; i++) {
+		TEST_ASSERT_TRUE(stats[i].iterations > 0);
+		TEST_ASSERT_EQUAL_UINT64(0, stats[i].went_backward);
+		TEST_ASSERT_EQUAL_UINT64(0, stats[i].count_mismatch);
+		TEST_ASSERT_EQUAL_UINT64(0, stats[i].unsorted);
+	}
+
+	Indexer_Reader *reader = indexer_reader_register(ctx);
+	const Indexer_Snapshot *snap = indexer_snapshot_pin(reader);
+	TEST_ASSERT_EQUAL_UINT64(total, indexer_snapshot_entry_nums(snap));
+	indexer_snapshot_unpin(reader);
+	indexer_reader_unregister(reader);
+}
+
+// Test 4: Reader slots run out and are reusable
+void test_snapshot_reader_slots(void) {
+	TEST_ASSERT_TRUE(indexer_live_init(ctx));
+	Indexer_Reader *readers[INDEXER_MAX_READERS];
+	for (int i = 0; i < INDEXER_MAX_READERS; i++) {
+		readers[i] = indexer_reader_register(ctx);
+		TEST_ASSERT_NOT_NULL(readers[i]);
+	}
+	TEST_ASSERT_NULL(indexer_reader_register(ctx));
+	indexer_reader_unregister(readers[3]);
+	TEST_ASSERT_EQUAL_PTR(readers[3], indexer_reader_register(ctx));
+	for (int i = 0; i < INDEXER_MAX_READERS; i++) {
+		indexer_reader_unregister(readers[i]);
+	}
+}
+
+// Test 5: Entries claimed but missing
+void test_snapshot_init_null_entries(void) {
+	indexer_ctx_set_entries(ctx, NULL, 5);
+	TEST_ASSERT_FALSE(indexer_live_init(ctx));
+}
+
+// Test 6: Entry points reading ctx directly refuse to run in live mode
+void test_snapshot_ctx_frozen(void) {
+	u8 *entries = malloc(10 * entry_size);
+	srand(6);
+	fill_random(entries, 10, 0);
+	indexer_ctx_set_entries(ctx, entries, 10);
+	TEST_ASSERT_TRUE(indexer_live_init(ctx));
+	TEST_ASSERT_TRUE(indexer_append_entries(ctx, entries, 10));
+
+	u8 lo[KEY_SIZE] = {0};
+	u8 hi[KEY_SIZE];
+	memset(hi, 0xff, KEY_SIZE);
+	Indexer_Entry *first = (Indexer_Entry *)entries;
+	TEST_ASSERT_EQUAL_UINT64(0, indexer_range_scan(ctx, lo, hi, &first));
+	TEST_ASSERT_NULL(first);
+	TEST_ASSERT_FALSE(indexer_sort_entries(ctx));
+	TEST_ASSERT_FALSE(indexer_write_index(ctx, "/nonexistent/never_written"));
+	TEST_ASSERT_NULL(indexer_writer_open(ctx, "/nonexistent/never_written"));
+	TEST_ASSERT_FALSE(indexer_write_sharded(ctx, "/nonexistent/never_written", 1, NULL, 0));
+
+	indexer_live_destroy(ctx);
+	TEST_ASSERT_TRUE(indexer_sort_entries(ctx));
+	TEST_ASSERT_EQUAL_UINT64(10, indexer_range_scan(ctx, lo, hi, &first));
+	free(entries);
+}
+
+int main(void) {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_snapshot_initial);
+	RUN_TEST(test_snapshot_isolation);
+	RUN_TEST(test_snapshot_concurrent_readers);
+	RUN_TEST(test_snapshot_reader_slots);
+	RUN_TEST(test_snapshot_init_null_entries);
+	RUN_TEST(test_snapshot_ctx_frozen);
+
+	return UNITY_END();
+}